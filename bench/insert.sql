@@ -0,0 +1,3 @@
+-- Load of a collection by pgv_insert() calls
+SELECT pgv_insert('bench_load', 'r', row(i, md5(i::text))) FROM generate_series(1, :nrecords) i;
+SELECT pgv_remove('bench_load');
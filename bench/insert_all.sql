@@ -0,0 +1,4 @@
+-- Load of a collection by one pgv_insert_all() call
+SELECT pgv_insert_all('bench_load', 'r',
+	(SELECT array_agg(row(i, md5(i::text))::pgv_bench_rec) FROM generate_series(1, :nrecords) i));
+SELECT pgv_remove('bench_load');
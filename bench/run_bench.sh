@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+
+#
+# Copyright (c) 2022, Postgres Professional
+#
+# Runs the pgbench scripts of this directory against the server and the
+# database given by the usual libpq environment variables, and saves
+# transactions per second and average latency of each script.
+#
+# settings:
+#		* DURATION - seconds to run each script (10)
+#		* CLIENTS - number of pgbench clients (1)
+#		* NRECORDS - number of records of benchmark collections (100000)
+#		* NPACKAGES - number of packages for pgv_stats() (1000)
+#		* SCRIPTS - names of scripts to run (all)
+#		* OUTPUT - file to save results to (bench_results.txt)
+#		* BASELINE - results of a previous run to compare with
+#		* THRESHOLD - loss of tps in percents to report a regression (10)
+#
+
+set -u
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+PSQL=${PSQL:-psql}
+PGBENCH=${PGBENCH:-pgbench}
+DURATION=${DURATION:-10}
+CLIENTS=${CLIENTS:-1}
+NRECORDS=${NRECORDS:-100000}
+NPACKAGES=${NPACKAGES:-1000}
+SCRIPTS=${SCRIPTS:-"scalar_int scalar_text scalar_numeric scalar_jsonb \
+	insert insert_all select_scan select_key select_array savepoints stats"}
+OUTPUT=${OUTPUT:-bench_results.txt}
+THRESHOLD=${THRESHOLD:-10}
+status=0
+
+$PSQL -X -q -v ON_ERROR_STOP=1 -f "$BENCH_DIR/setup.sql" || exit 1
+
+version=$($PSQL -X -A -t -c \
+	"SELECT extversion FROM pg_extension WHERE extname = 'pg_variables'")
+server=$($PSQL -X -A -t -c "SHOW server_version")
+
+# Results of runs with the same settings are comparable
+echo "# pg_variables $version, PostgreSQL $server, duration $DURATION," \
+	"clients $CLIENTS, records $NRECORDS, packages $NPACKAGES" > "$OUTPUT"
+printf "%-16s %12s %12s\n" "# script" "tps" "latency_ms" >> "$OUTPUT"
+
+for script in $SCRIPTS; do
+	out=$($PGBENCH -n -T "$DURATION" -c "$CLIENTS" -j "$CLIENTS" \
+		-D loaded=0 -D nrecords="$NRECORDS" -D npackages="$NPACKAGES" \
+		-f "$BENCH_DIR/$script.sql" 2>&1)
+	if [ $? -ne 0 ]; then echo "$out"; exit 1; fi
+
+	# The last tps line excludes connection time in old pgbench versions
+	tps=$(echo "$out" | sed -n 's/^tps = \([0-9.]*\).*/\1/p' | tail -1)
+	latency=$(echo "$out" | sed -n 's/^latency average = \([0-9.]*\) ms.*/\1/p')
+	printf "%-16s %12s %12s\n" "$script" "$tps" "$latency" >> "$OUTPUT"
+done
+
+cat "$OUTPUT"
+
+# compare with the baseline if asked to
+if [ -n "${BASELINE:-}" ]; then
+	echo "# changes of tps compared with $BASELINE"
+	awk -v threshold="$THRESHOLD" '
+		/^#/ { next }
+		NR == FNR { base[$1] = $2; next }
+		($1 in base) && base[$1] > 0 {
+			change = ($2 - base[$1]) * 100 / base[$1]
+			mark = ""
+			if (change < -threshold) { mark = "  REGRESSION"; failed = 1 }
+			printf "%-16s %+11.1f%%%s\n", $1, change, mark
+		}
+		END { exit failed }' "$BASELINE" "$OUTPUT" || status=1
+fi
+
+exit $status
@@ -0,0 +1,9 @@
+-- Changes of the transactional collection within savepoints
+\if :loaded = 0
+SELECT pgv_bench_load(:nrecords, :npackages);
+\set loaded 1
+\endif
+\set id random(1, :nrecords)
+BEGIN;
+SELECT pgv_bench_savepoints(:id, 100);
+COMMIT;
@@ -0,0 +1,4 @@
+-- Set and get of integer variables
+\set id random(1, 100)
+SELECT pgv_set('bench_scalar', 'v' || :id, :id);
+SELECT pgv_get('bench_scalar', 'v' || :id, NULL::int);
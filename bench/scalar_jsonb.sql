@@ -0,0 +1,4 @@
+-- Set and get of jsonb variables
+\set id random(1, 100)
+SELECT pgv_set('bench_scalar', 'v' || :id, jsonb_build_object('id', :id, 'val', 'x'));
+SELECT pgv_get('bench_scalar', 'v' || :id, NULL::jsonb);
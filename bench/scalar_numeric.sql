@@ -0,0 +1,4 @@
+-- Set and get of numeric variables
+\set id random(1, 100)
+SELECT pgv_set('bench_scalar', 'v' || :id, :id * 1.5);
+SELECT pgv_get('bench_scalar', 'v' || :id, NULL::numeric);
@@ -0,0 +1,7 @@
+-- Lookups of records by arrays of keys
+\if :loaded = 0
+SELECT pgv_bench_load(:nrecords, :npackages);
+\set loaded 1
+\endif
+\set id random(1, :nrecords - 9)
+SELECT count(*) FROM pgv_select('bench', 'r', ARRAY[:id, :id + 1, :id + 2, :id + 3, :id + 4, :id + 5, :id + 6, :id + 7, :id + 8, :id + 9]) AS (id int, val text);
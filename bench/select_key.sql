@@ -0,0 +1,7 @@
+-- Lookups of records by keys
+\if :loaded = 0
+SELECT pgv_bench_load(:nrecords, :npackages);
+\set loaded 1
+\endif
+\set id random(1, :nrecords)
+SELECT pgv_select('bench', 'r', :id);
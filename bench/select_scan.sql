@@ -0,0 +1,6 @@
+-- Full scan of a collection
+\if :loaded = 0
+SELECT pgv_bench_load(:nrecords, :npackages);
+\set loaded 1
+\endif
+SELECT count(*) FROM pgv_select('bench', 'r') AS (id int, val text);
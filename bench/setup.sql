@@ -0,0 +1,39 @@
+-- Objects used by the benchmark scripts, see run_bench.sh
+
+CREATE EXTENSION IF NOT EXISTS pg_variables;
+
+DROP TYPE IF EXISTS pgv_bench_rec CASCADE;
+CREATE TYPE pgv_bench_rec AS (id int, val text);
+
+-- Load variables of the session, each client calls it once
+CREATE OR REPLACE FUNCTION pgv_bench_load(nrecords int, npackages int)
+RETURNS void AS $$
+BEGIN
+	PERFORM pgv_insert_all('bench', 'r',
+		(SELECT array_agg(row(i, md5(i::text))::pgv_bench_rec)
+		 FROM generate_series(1, nrecords) i));
+	PERFORM pgv_insert_all('bench', 't',
+		(SELECT array_agg(row(i, md5(i::text))::pgv_bench_rec)
+		 FROM generate_series(1, nrecords) i), true);
+	PERFORM pgv_set('bench_' || i, 'v', i) FROM generate_series(1, npackages) i;
+END
+$$ LANGUAGE plpgsql;
+
+-- Change the transactional variable in a loop of subtransactions, every
+-- second one is rolled back
+CREATE OR REPLACE FUNCTION pgv_bench_savepoints(id int, nloops int)
+RETURNS void AS $$
+BEGIN
+	FOR i IN 1..nloops LOOP
+		BEGIN
+			PERFORM pgv_update('bench', 't', row(id, md5(i::text))::pgv_bench_rec);
+			PERFORM pgv_set('bench', 'ts', i, true);
+			IF i % 2 = 0 THEN
+				RAISE EXCEPTION 'rollback';
+			END IF;
+		EXCEPTION WHEN raise_exception THEN
+			NULL;
+		END;
+	END LOOP;
+END
+$$ LANGUAGE plpgsql;
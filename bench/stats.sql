@@ -0,0 +1,6 @@
+-- Statistics of many packages
+\if :loaded = 0
+SELECT pgv_bench_load(:nrecords, :npackages);
+\set loaded 1
+\endif
+SELECT count(*) FROM pgv_stats();
@@ -0,0 +1,222 @@
+/* contrib/pg_variables/pg_variables--1.2--1.3.sql */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION pg_variables UPDATE TO '1.3'" to load this file. \quit
+
+-- Functions to work with records
+
+CREATE FUNCTION pgv_insert_all(package text, name text, r anyarray, is_transactional bool default false)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_insert_all'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_reserve(package text, name text, n bigint)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_reserve'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_create_ordered_index(package text, name text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_create_ordered_index'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_select_range(package text, name text, lo anynonarray, hi anynonarray)
+RETURNS setof record
+AS 'MODULE_PATHNAME', 'variable_select_range'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_create_index(package text, name text, attnum int)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_create_index'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_select_by(package text, name text, attnum int, value anynonarray)
+RETURNS setof record
+AS 'MODULE_PATHNAME', 'variable_select_by'
+LANGUAGE C VOLATILE;
+
+-- Planner estimates for the other pgv_select() functions
+
+ALTER FUNCTION pgv_select(package text, name text, value anynonarray)
+SUPPORT pgv_select_support;
+
+ALTER FUNCTION pgv_select(package text, name text, value anyarray)
+SUPPORT pgv_select_support;
+
+-- Functions to insert or replace records
+
+CREATE FUNCTION pgv_upsert(package text, name text, r record, is_transactional bool default false)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'variable_upsert'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_upsert_all(package text, name text, r anyarray, is_transactional bool default false)
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'variable_upsert_all'
+LANGUAGE C VOLATILE;
+
+-- Functions to remove many records at once
+
+CREATE FUNCTION pgv_delete(package text, name text, value anyarray)
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'variable_delete_all'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_truncate(package text, name text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_truncate'
+LANGUAGE C VOLATILE;
+
+-- Functions to scan attributes of records
+
+CREATE FUNCTION pgv_select_column(package text, name text, attnum int, att_type anynonarray)
+RETURNS SETOF anynonarray
+AS 'MODULE_PATHNAME', 'variable_select_column'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_count(package text, name text, attnum int)
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'variable_count'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_sum(package text, name text, attnum int)
+RETURNS numeric
+AS 'MODULE_PATHNAME', 'variable_sum'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_min_max(package text, name text, attnum int, att_type anynonarray,
+							OUT min anynonarray, OUT max anynonarray)
+RETURNS record
+AS 'MODULE_PATHNAME', 'variable_min_max'
+LANGUAGE C VOLATILE;
+
+-- Cursors over records, which keep their position across statements
+
+CREATE FUNCTION pgv_cursor_open(package text, name text)
+RETURNS int
+AS 'MODULE_PATHNAME', 'cursor_open'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_cursor_fetch(cursor int, n int)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'cursor_fetch'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_cursor_close(cursor int)
+RETURNS void
+AS 'MODULE_PATHNAME', 'cursor_close'
+LANGUAGE C VOLATILE;
+
+-- Functions to modify scalar variables
+
+CREATE FUNCTION pgv_incr(package text, name text, delta anynonarray, is_transactional bool default false)
+RETURNS anynonarray
+AS 'MODULE_PATHNAME', 'variable_incr'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_append(package text, name text, value text, is_transactional bool default false)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_append'
+LANGUAGE C VOLATILE;
+
+-- Statistics of packages with numbers of variables and records
+
+DROP FUNCTION pgv_stats();
+
+CREATE FUNCTION pgv_stats()
+RETURNS TABLE(package text, allocated_memory bigint,
+			  regular_memory bigint, transactional_memory bigint,
+			  variables bigint, records bigint)
+AS 'MODULE_PATHNAME', 'get_packages_stats'
+LANGUAGE C VOLATILE;
+
+-- Functions to list only packages with names matching LIKE pattern
+
+CREATE FUNCTION pgv_list(pattern text)
+RETURNS TABLE(package text, name text, is_transactional bool)
+AS 'MODULE_PATHNAME', 'get_packages_and_variables'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_stats(pattern text)
+RETURNS TABLE(package text, allocated_memory bigint,
+			  regular_memory bigint, transactional_memory bigint,
+			  variables bigint, records bigint)
+AS 'MODULE_PATHNAME', 'get_packages_stats'
+LANGUAGE C VOLATILE;
+
+-- Counters of work done by the session
+
+CREATE FUNCTION pgv_perf_stats()
+RETURNS TABLE(counter text, value bigint)
+AS 'MODULE_PATHNAME', 'get_perf_stats'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_reset_perf_stats()
+RETURNS void
+AS 'MODULE_PATHNAME', 'reset_perf_stats'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_hash_stats(package text, name text,
+							   OUT records bigint, OUT hash_collisions bigint)
+RETURNS record
+AS 'MODULE_PATHNAME', 'variable_hash_stats'
+LANGUAGE C VOLATILE;
+
+-- Functions to work with shared variables
+
+CREATE FUNCTION pgv_share(package text, name text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_share'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_unshare(package text, name text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_unshare'
+LANGUAGE C VOLATILE;
+
+-- Functions to dump and load packages
+
+CREATE FUNCTION pgv_dump(package text)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'package_dump'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_load(dump bytea)
+RETURNS void
+AS 'MODULE_PATHNAME', 'package_load'
+LANGUAGE C VOLATILE;
+
+-- Records of the dump are loaded without checks, so it should be trusted
+REVOKE ALL ON FUNCTION pgv_load(bytea) FROM PUBLIC;
+
+-- Functions which only read variables may run in the leader of parallel
+-- queries, so that other parts of such queries can be run by workers.
+-- Workers don't see variables of the session.
+
+ALTER FUNCTION pgv_get(package text, name text, var_type anynonarray, strict bool) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_get(package text, name text, var_type anyarray, strict bool) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_get_int(package text, name text, strict bool) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_get_text(package text, name text, strict bool) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_get_numeric(package text, name text, strict bool) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_get_timestamp(package text, name text, strict bool) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_get_timestamptz(package text, name text, strict bool) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_get_date(package text, name text, strict bool) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_get_jsonb(package text, name text, strict bool) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_select(package text, name text) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_select(package text, name text, value anynonarray) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_select(package text, name text, value anyarray) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_select_range(package text, name text, lo anynonarray, hi anynonarray) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_select_by(package text, name text, attnum int, value anynonarray) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_select_column(package text, name text, attnum int, att_type anynonarray) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_count(package text, name text, attnum int) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_sum(package text, name text, attnum int) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_min_max(package text, name text, attnum int, att_type anynonarray) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_exists(package text, name text) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_exists(package text) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_list() PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_stats() PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_list(pattern text) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_stats(pattern text) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_perf_stats() PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_hash_stats(package text, name text) PARALLEL RESTRICTED;
+ALTER FUNCTION pgv_dump(package text) PARALLEL RESTRICTED;
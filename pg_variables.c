@@ -12,21 +12,45 @@
 #include "funcapi.h"
 #include "miscadmin.h"
 
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#else
+#include "access/hash.h"
+#endif
+#if PG_VERSION_NUM >= 130000
+#include "access/detoast.h"
+#include "access/toast_internals.h"
+#else
+#include "access/tuptoaster.h"
+#endif
+#if PG_VERSION_NUM >= 140000
+#include "access/toast_compression.h"
+#endif
 #include "access/htup_details.h"
 #include "access/xact.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_collation.h"
 #include "catalog/pg_type.h"
+#if PG_VERSION_NUM >= 110000
+#include "common/int.h"
+#endif
+#include "libpq/pqformat.h"
 #include "nodes/nodes.h"
 #include "nodes/nodeFuncs.h"
 #include "nodes/primnodes.h"
 #include "nodes/supportnodes.h"
+#include "nodes/value.h"
 #include "optimizer/optimizer.h"
 #include "parser/scansup.h"
+#include "storage/buffile.h"
 #include "storage/proc.h"
 #include "utils/builtins.h"
 #include "utils/datum.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
+#include "utils/syscache.h"
 #include "utils/timestamp.h"
+#include "utils/tuplestore.h"
 #include "utils/typcache.h"
 
 #include "pg_variables.h"
@@ -35,12 +59,45 @@ PG_MODULE_MAGIC;
 
 /* Functions to work with records */
 PG_FUNCTION_INFO_V1(variable_insert);
+PG_FUNCTION_INFO_V1(variable_insert_all);
 PG_FUNCTION_INFO_V1(variable_update);
+PG_FUNCTION_INFO_V1(variable_upsert);
+PG_FUNCTION_INFO_V1(variable_upsert_all);
 PG_FUNCTION_INFO_V1(variable_delete);
+PG_FUNCTION_INFO_V1(variable_delete_all);
+PG_FUNCTION_INFO_V1(variable_truncate);
+PG_FUNCTION_INFO_V1(variable_reserve);
+PG_FUNCTION_INFO_V1(variable_create_ordered_index);
+PG_FUNCTION_INFO_V1(variable_create_index);
 
 PG_FUNCTION_INFO_V1(variable_select);
 PG_FUNCTION_INFO_V1(variable_select_by_value);
 PG_FUNCTION_INFO_V1(variable_select_by_values);
+PG_FUNCTION_INFO_V1(variable_select_range);
+PG_FUNCTION_INFO_V1(variable_select_by);
+
+/* Functions to scan attributes of records */
+PG_FUNCTION_INFO_V1(variable_select_column);
+PG_FUNCTION_INFO_V1(variable_count);
+PG_FUNCTION_INFO_V1(variable_sum);
+PG_FUNCTION_INFO_V1(variable_min_max);
+
+/* Functions to work with cursors over records */
+PG_FUNCTION_INFO_V1(cursor_open);
+PG_FUNCTION_INFO_V1(cursor_fetch);
+PG_FUNCTION_INFO_V1(cursor_close);
+
+/* Functions to dump and load packages */
+PG_FUNCTION_INFO_V1(package_dump);
+PG_FUNCTION_INFO_V1(package_load);
+
+/* Functions to work with shared variables */
+PG_FUNCTION_INFO_V1(variable_share);
+PG_FUNCTION_INFO_V1(variable_unshare);
+
+/* Functions to modify scalar variables */
+PG_FUNCTION_INFO_V1(variable_incr);
+PG_FUNCTION_INFO_V1(variable_append);
 
 /* Functions to work with packages */
 PG_FUNCTION_INFO_V1(variable_exists);
@@ -50,6 +107,9 @@ PG_FUNCTION_INFO_V1(remove_package);
 PG_FUNCTION_INFO_V1(remove_packages);
 PG_FUNCTION_INFO_V1(get_packages_and_variables);
 PG_FUNCTION_INFO_V1(get_packages_stats);
+PG_FUNCTION_INFO_V1(get_perf_stats);
+PG_FUNCTION_INFO_V1(reset_perf_stats);
+PG_FUNCTION_INFO_V1(variable_hash_stats);
 PG_FUNCTION_INFO_V1(variable_select_support);
 
 extern void _PG_init(void);
@@ -57,7 +117,6 @@ extern void _PG_init(void);
 extern void _PG_fini(void);
 #endif
 static void ensurePackagesHashExists(void);
-static void getKeyFromName(text *name, char *key);
 
 static Package *getPackage(text *name, bool strict);
 static Package *createPackage(text *name, bool is_trans);
@@ -65,6 +124,9 @@ static Variable *getVariableInternal(Package *package, text *name,
 									 Oid typid, bool is_record, bool strict);
 static Variable *createVariableInternal(Package *package, text *name, Oid typid,
 										bool is_record, bool is_transactional);
+static Variable *getVariable(FmgrInfo *flinfo, text *package_name,
+							 text *var_name, Oid typid, bool is_record,
+							 bool strict);
 static void removePackageInternal(Package *package);
 static void resetVariablesCache(void);
 
@@ -77,13 +139,14 @@ static void copyValue(VarState *src, VarState *dest, Variable *destVar);
 static void freeValue(VarState *varstate, bool is_record);
 static void removeState(TransObject *object, TransObjectType type,
 						TransState *stateToDelete);
+static void releaseRecordState(VarState *state, VarState *prevState);
 static bool isObjectChangedInCurrentTrans(TransObject *object);
 static bool isObjectChangedInUpperTrans(TransObject *object);
 
 static void addToChangesStack(TransObject *object, TransObjectType type);
 static void addToChangesStackUpperLevel(TransObject *object,
 										TransObjectType type);
-static void pushChangesStack(void);
+static ChangesStackNode *getChangesStackNode(int level);
 
 static int	numOfRegVars(Package *package);
 
@@ -98,6 +161,13 @@ static inline ChangedObject * makeChangedObject(TransObject *object,
 												MemoryContext ctx);
 static void initObjectHistory(TransObject *object, TransObjectType type);
 
+/* Spilling of packages */
+static void spillPackages(void);
+static void reloadPackage(Package *package);
+static void listSpilledVariables(Package *package, Tuplestorestate *tupstore,
+								 TupleDesc tupdesc);
+static void releaseSpilledPackage(Package *package);
+
 /* Hook functions */
 static void variable_ExecutorEnd(QueryDesc *queryDesc);
 
@@ -130,15 +200,89 @@ do { \
 /* User controlled GUCs */
 bool convert_unknownoid_guc;
 bool convert_unknownoid;
+static int	max_memory = 0;
+bool		track_perf_stats = false;
+int			compression_threshold = 0;
+static int	spill_memory = 0;
+static int	spill_timeout = 0;
+
+PerfStats	perf_stats;
 
 static HTAB *packagesHash = NULL;
 static MemoryContext ModuleContext = NULL;
 
-/* Recent package */
-static Package *LastPackage = NULL;
+/*
+ * Estimate of memory allocated by the module, see check_memory_limit() and
+ * release_memory(). It is counted exactly only when it reaches
+ * pg_variables.max_memory.
+ */
+static Size allocatedMemory = 0;
+
+/*
+ * Cursor over records of a variable, which keeps its position across
+ * statements and transactions. Records are fetched in order of keys by the
+ * ordered index of the variable. The position is the key of the last fetched
+ * record, so the cursor stays valid under any changes of the variable.
+ */
+typedef struct RecordCursor
+{
+	int32		id;				/* key of the cursors hash */
+	char		package[NAMEDATALEN];
+	char		name[NAMEDATALEN];
+	Oid			keytype;
+	bool		keybyval;
+	int16		keylen;
+	/* Key of the last fetched record, allocated within CursorsContext */
+	Datum		last;
+	bool		last_is_null;
+	bool		has_last;
+} RecordCursor;
+
+/* Cursors aren't released with packages, so they have their own context */
+static HTAB *cursorsHash = NULL;
+static MemoryContext CursorsContext = NULL;
+static int32 lastCursorId = 0;
+
+/*
+ * Temporary file with spilled packages, see spillPackages(). Dumps of packages
+ * are appended to its end, the file is closed when there are no spilled
+ * packages anymore. The file is rewritten when released dumps take more space
+ * than the dumps of spilled packages.
+ */
+static BufFile *spillFile = NULL;
+static int	spillFileEndno = 0;
+static off_t spillFileEnd = 0;
+static int	spilledPackages = 0;
+static int64 spillFileSize = 0;
+static int64 spillFileDead = 0;
+/* Time of the last check of packages which haven't been used for long */
+static TimestampTz lastSpillCheck = 0;
+
+/*
+ * Cache of recently used variables, see getVariable(). It is a direct-mapped
+ * table indexed by the hash of package and variable names.
+ */
+#define NUMCACHEDVARIABLES 64
+
+static Variable *VariablesCache[NUMCACHEDVARIABLES];
+
+/*
+ * Generation of cached variables, it is incremented each time the cache is
+ * reset. Variables resolved by function calls are valid while it isn't changed.
+ */
+static uint64 VariablesCacheGeneration = 0;
 
-/* Recent variable */
-static Variable *LastVariable = NULL;
+/*
+ * Variable resolved by a function call with constant package and variable
+ * names, it is stored in fn_extra.
+ */
+typedef struct VariableHandle
+{
+	/* Package and variable names are constant, so they can be resolved */
+	bool		const_names;
+	uint64		generation;
+	Variable   *variable;
+}			VariableHandle;
 
 /* Saved hook values for recall */
 static ExecutorEnd_hook_type prev_ExecutorEnd = NULL;
@@ -146,6 +290,11 @@ static ExecutorEnd_hook_type prev_ExecutorEnd = NULL;
 /* This stack contains lists of changed variables and packages per each subxact level */
 static dlist_head *changesStack = NULL;
 static MemoryContext changesStackContext = NULL;
+/*
+ * Nodes of changesStack of finished subxacts, they are reused with their
+ * memory contexts by next subxacts. Allocated within changesStackContext.
+ */
+static dlist_head *changesStackFree = NULL;
 
 /*
  * List to store all the running hash_seq_search, variable and package scan for
@@ -161,12 +310,17 @@ static MemoryContext changesStackContext = NULL;
  *
  * TopTransactionContext is handy here, because it would not be reset by the
  * time pgvTransCallback is called.
+ *
+ * The lists are doubly linked, so the entry of a finished scan is removed
+ * without search of the list.
  */
-static List *variables_stats = NIL;
-static List *packages_stats = NIL;
+static dlist_head variables_stats = DLIST_STATIC_INIT(variables_stats);
+static dlist_head packages_stats = DLIST_STATIC_INIT(packages_stats);
 
+/* The node is the first member, so entries are cast from list nodes */
 typedef struct tagVariableStatEntry
 {
+	dlist_node	node;
 	HTAB	   *hash;
 	HASH_SEQ_STATUS *status;
 	Variable   *variable;
@@ -177,6 +331,7 @@ typedef struct tagVariableStatEntry
 
 typedef struct tagPackageStatEntry
 {
+	dlist_node	node;
 	HASH_SEQ_STATUS *status;
 	Levels		levels;
 	void	  **user_fctx; /* pointer to funcctx->user_fctx */
@@ -191,6 +346,7 @@ typedef struct PgvContextStruct
 {
 	dlist_head *changesStack;
 	MemoryContext changesStackContext;
+	dlist_head *changesStackFree;
 	struct PgvContextStruct *next;
 } PgvContextStruct;
 
@@ -201,12 +357,6 @@ static PgvContextStruct *pgv_context = NULL;
 /*
  * Compare functions for VariableStatEntry and PackageStatEntry members.
  */
-static bool
-VariableStatEntry_status_eq(void *entry, void *value)
-{
-	return ((VariableStatEntry *) entry)->status == (HASH_SEQ_STATUS *) value;
-}
-
 static bool
 VariableStatEntry_variable_eq(void *entry, void *value)
 {
@@ -236,12 +386,6 @@ VariableStatEntry_level_eq(void *entry, void *value)
 		((VariableStatEntry *) entry)->levels.level == ((Levels *) value)->level;
 }
 
-static bool
-PackageStatEntry_status_eq(void *entry, void *value)
-{
-	return ((PackageStatEntry *) entry)->status == (HASH_SEQ_STATUS *) value;
-}
-
 static bool
 PackageStatEntry_level_eq(void *entry, void *value)
 {
@@ -310,7 +454,7 @@ PackageStatEntry_clear_fctx(void *entry)
  */
 typedef struct tagRemoveIfContext
 {
-	List	  **list;			/* target list */
+	dlist_head *list;			/* target list */
 	void	   *value;			/* value to compare with */
 	bool		(*eq) (void *, void *); /* list item eq to value func */
 	HASH_SEQ_STATUS *(*getter) (void *);	/* status getter */
@@ -322,22 +466,18 @@ typedef struct tagRemoveIfContext
 static void
 list_remove_if(RemoveIfContext ctx)
 {
-#if (PG_VERSION_NUM < 130000)
-	ListCell   *cell,
-			   *next,
-			   *prev = NULL;
-	void	   *entry = NULL;
+	dlist_mutable_iter iter;
 
-	for (cell = list_head(*ctx.list); cell; cell = next)
+	dlist_foreach_modify(iter, ctx.list)
 	{
-		entry = lfirst(cell);
-		next = lnext(cell);
+		void	   *entry = (void *) iter.cur;
 
 		if (ctx.eq(entry, ctx.value))
 		{
-			*ctx.list = list_delete_cell(*ctx.list, cell, prev);
+			dlist_delete(iter.cur);
 
-			if (ctx.term)
+			/* Ordered scans of records have no status */
+			if (ctx.term && ctx.getter(entry))
 #ifdef PGPRO_EE
 				hash_seq_term_all_levels(ctx.getter(entry));
 #else
@@ -346,79 +486,54 @@ list_remove_if(RemoveIfContext ctx)
 
 			ctx.clear_fctx(entry);
 
-			pfree(ctx.getter(entry));
+			if (ctx.getter(entry))
+				pfree(ctx.getter(entry));
 			pfree(entry);
 
 			if (ctx.match_first)
 				return;
 		}
-		else
-		{
-			prev = cell;
-		}
 	}
-#else
-	/*
-	 * See
-	 * https://git.postgresql.org/gitweb/?p=postgresql.git;a=commit;h=1cff1b95ab6ddae32faa3efe0d95a820dbfdc164
-	 *
-	 * Version >= 13 have different lists interface.
-	 */
-	ListCell   *cell;
-	void	   *entry = NULL;
-
-	foreach(cell, *ctx.list)
-	{
-		entry = lfirst(cell);
-
-		if (ctx.eq(entry, ctx.value))
-		{
-			*ctx.list = foreach_delete_current(*ctx.list, cell);
-
-			if (ctx.term)
-#ifdef PGPRO_EE
-				hash_seq_term_all_levels(ctx.getter(entry));
-#else
-				hash_seq_term(ctx.getter(entry));
-#endif
-
-			ctx.clear_fctx(entry);
+}
 
-			pfree(ctx.getter(entry));
-			pfree(entry);
+/*
+ * Remove the entry of the finished scan of records. The entry isn't in the
+ * list if the list was cleared by freeStatsLists().
+ */
+static void
+removeVariableStatEntry(VariableStatEntry *entry)
+{
+	if (entry->node.next == NULL)
+		return;
 
-			if (ctx.match_first)
-				return;
-		}
-	}
-#endif
+	dlist_delete(&entry->node);
+	VariableStatEntry_clear_fctx(entry);
+	if (entry->status)
+		pfree(entry->status);
+	pfree(entry);
 }
 
 /*
- * Remove first entry for status.
+ * Remove the entry of the finished scan of packages, see
+ * removeVariableStatEntry().
  */
 static void
-remove_variables_status(List **list, HASH_SEQ_STATUS *status)
+removePackageStatEntry(PackageStatEntry *entry)
 {
-	RemoveIfContext ctx =
-	{
-		.list = list,
-		.value = status,
-		.eq = VariableStatEntry_status_eq,
-		.getter = VariableStatEntry_status_ptr,
-		.match_first = true,
-		.term = false,
-		.clear_fctx = VariableStatEntry_clear_fctx
-	};
+	if (entry->node.next == NULL)
+		return;
 
-	list_remove_if(ctx);
+	dlist_delete(&entry->node);
+	PackageStatEntry_clear_fctx(entry);
+	pfree(entry->status);
+	pfree(entry);
 }
 
 /*
  * Remove first entry for variable.
  */
 static void
-remove_variables_variable(List **list, Variable *variable)
+remove_variables_variable(dlist_head *list, Variable *variable)
 {
 	/*
 	 * It may be more than one item in the list for each variable in case of
@@ -442,7 +557,7 @@ remove_variables_variable(List **list, Variable *variable)
  * Remove all the entries for package.
  */
 static void
-remove_variables_package(List **list, Package *package)
+remove_variables_package(dlist_head *list, Package *package)
 {
 	RemoveIfContext ctx =
 	{
@@ -462,7 +577,7 @@ remove_variables_package(List **list, Package *package)
  * Remove all the entries for level.
  */
 static void
-remove_variables_level(List **list, Levels *levels)
+remove_variables_level(dlist_head *list, Levels *levels)
 {
 	RemoveIfContext ctx =
 	{
@@ -482,7 +597,7 @@ remove_variables_level(List **list, Levels *levels)
  * Delete variables stats list.
  */
 static void
-remove_variables_all(List **list)
+remove_variables_all(dlist_head *list)
 {
 	RemoveIfContext ctx =
 	{
@@ -498,31 +613,11 @@ remove_variables_all(List **list)
 	list_remove_if(ctx);
 }
 
-/*
- * Remove first entrie with status for packages list.
- */
-static void
-remove_packages_status(List **list, HASH_SEQ_STATUS *status)
-{
-	RemoveIfContext ctx =
-	{
-		.list = list,
-		.value = status,
-		.eq = PackageStatEntry_status_eq,
-		.getter = PackageStatEntry_status_ptr,
-		.match_first = true,
-		.term = false,
-		.clear_fctx = PackageStatEntry_clear_fctx
-	};
-
-	list_remove_if(ctx);
-}
-
 /*
  * Remove all the entries with level for packages list.
  */
 static void
-remove_packages_level(List **list, Levels *levels)
+remove_packages_level(dlist_head *list, Levels *levels)
 {
 	RemoveIfContext ctx =
 	{
@@ -543,7 +638,7 @@ remove_packages_level(List **list, Levels *levels)
  * Remove all transactional entries.
  */
 static void
-remove_variables_transactional(List **list)
+remove_variables_transactional(dlist_head *list)
 {
 	RemoveIfContext ctx =
 	{
@@ -563,11 +658,6 @@ remove_variables_transactional(List **list)
 static void freeStatsLists(void);
 
 /* Returns a lists of packages and variables changed at current subxact level */
-#define get_actual_changes_list() \
-	( \
-		AssertMacro(changesStack != NULL), \
-		(dlist_head_element(ChangesStackNode, node, changesStack)) \
-	)
 #define pack_hctx(pack, is_trans) \
 			(is_trans ? pack->hctxTransact : pack->hctxRegular)
 #define pack_htab(pack, is_trans) \
@@ -591,56 +681,334 @@ static void freeStatsLists(void);
 
 
 /*
- * Set value of variable, typlen could be 0 if typbyval == true
+ * Get the slot of the variables cache for the variable of the package.
+ */
+static inline Variable **
+getVariablesCacheSlot(text *package_name, text *var_name)
+{
+	uint32		hash;
+
+	hash = DatumGetUInt32(hash_any((unsigned char *) VARDATA_ANY(var_name),
+								   VARSIZE_ANY_EXHDR(var_name)));
+	hash ^= DatumGetUInt32(hash_any((unsigned char *) VARDATA_ANY(package_name),
+									VARSIZE_ANY_EXHDR(package_name))) +
+		0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+	return &VariablesCache[hash % NUMCACHEDVARIABLES];
+}
+
+/* Check if the name of the object is equal to name */
+static inline bool
+isNameEqual(text *name, const char *object_name)
+{
+	int			len = VARSIZE_ANY_EXHDR(name);
+
+	return len < NAMEDATALEN &&
+		memcmp(VARDATA_ANY(name), object_name, len) == 0 &&
+		object_name[len] == '\0';
+}
+
+/* Check if the cached variable is the variable of the package */
+static inline bool
+isCachedVariable(Variable *variable, text *package_name, text *var_name)
+{
+	return isNameEqual(var_name, GetName(variable)) &&
+		isNameEqual(package_name, GetName(variable->package));
+}
+
+/*
+ * Check if the argument of the function call is a constant. Unlike
+ * get_fn_expr_arg_stable() parameters aren't accepted, since the same
+ * expression can be evaluated with different values of them.
+ */
+static bool
+isConstArg(FmgrInfo *flinfo, int argnum)
+{
+	Node	   *expr = flinfo->fn_expr;
+	List	   *args;
+
+	if (expr == NULL || !IsA(expr, FuncExpr))
+		return false;
+
+	args = ((FuncExpr *) expr)->args;
+	if (argnum >= list_length(args))
+		return false;
+
+	return IsA(list_nth(args, argnum), Const);
+}
+
+/*
+ * Create the variable handle of the function call. size may be greater than
+ * the size of VariableHandle if the function keeps its own data after it.
+ */
+static VariableHandle *
+initVariableHandle(FmgrInfo *flinfo, Size size)
+{
+	VariableHandle *handle;
+
+	Assert(flinfo->fn_extra == NULL && size >= sizeof(VariableHandle));
+
+	handle = (VariableHandle *) MemoryContextAllocZero(flinfo->fn_mcxt, size);
+	handle->const_names = isConstArg(flinfo, 0) && isConstArg(flinfo, 1);
+	flinfo->fn_extra = handle;
+
+	return handle;
+}
+
+/*
+ * Get the variable handle of the function call, it is created by the first
+ * call. Returns NULL if there is no function call info.
+ */
+static VariableHandle *
+getVariableHandle(FmgrInfo *flinfo)
+{
+	VariableHandle *handle;
+
+	if (flinfo == NULL)
+		return NULL;
+
+	handle = (VariableHandle *) flinfo->fn_extra;
+	if (handle == NULL)
+		handle = initVariableHandle(flinfo, sizeof(VariableHandle));
+
+	return handle;
+}
+
+/*
+ * Find the variable of the package in caches, its type and state aren't
+ * checked. The variable resolved by the previous call of the function is
+ * tried first, then the variables cache. slot is set to the slot of the
+ * variables cache if it has been looked up, NULL otherwise.
+ */
+static Variable *
+findCachedVariable(FmgrInfo *flinfo, text *package_name, text *var_name,
+				   Variable ***slot)
+{
+	VariableHandle *handle = getVariableHandle(flinfo);
+
+	*slot = NULL;
+	if (handle != NULL && handle->variable != NULL &&
+		handle->generation == VariablesCacheGeneration)
+	{
+		handle->variable->package->last_used = GetCurrentStatementStartTimestamp();
+		return handle->variable;
+	}
+
+	*slot = getVariablesCacheSlot(package_name, var_name);
+	if (**slot != NULL && isCachedVariable(**slot, package_name, var_name))
+	{
+		(**slot)->package->last_used = GetCurrentStatementStartTimestamp();
+		return **slot;
+	}
+
+	return NULL;
+}
+
+/*
+ * Put the variable of the package into the variables cache and resolve it for
+ * the function call if it is possible. slot may be NULL if it isn't known yet.
  */
 static void
-variable_set(text *package_name, text *var_name,
-			 Oid typid, Datum value, bool is_null, bool is_transactional)
+cacheVariable(FmgrInfo *flinfo, text *package_name, text *var_name,
+			  Variable **slot, Variable *variable)
+{
+	VariableHandle *handle = getVariableHandle(flinfo);
+
+	if (slot == NULL)
+		slot = getVariablesCacheSlot(package_name, var_name);
+	*slot = variable;
+
+	if (handle != NULL && handle->const_names)
+	{
+		handle->generation = VariablesCacheGeneration;
+		handle->variable = variable;
+	}
+}
+
+/*
+ * Return a pointer to existing variable of the package. It works like
+ * getPackage() and getVariableInternal() together, but a recently used
+ * variable is taken from caches without lookups in hash tables. flinfo may
+ * be NULL if the variable can't be resolved for the function call.
+ */
+static Variable *
+getVariable(FmgrInfo *flinfo, text *package_name, text *var_name, Oid typid,
+			bool is_record, bool strict)
 {
+	Variable  **slot;
+	Variable   *variable;
 	Package    *package;
+
+	PERF_COUNT(variable_lookups, 1);
+	variable = findCachedVariable(flinfo, package_name, var_name, &slot);
+
+	/*
+	 * Use the cached variable if the lookup would find it without errors,
+	 * otherwise do the lookup to report them.
+	 */
+	if (variable != NULL &&
+		GetActualState(variable->package)->is_valid &&
+		(typid == InvalidOid ||
+		 (variable->typid == typid && variable->is_record == is_record)) &&
+		(GetActualState(variable)->is_valid || !strict))
+	{
+		PERF_COUNT(lookup_cache_hits, 1);
+
+		/* Resolve the variable found in the variables cache */
+		if (slot != NULL)
+			cacheVariable(flinfo, package_name, var_name, slot, variable);
+		return variable;
+	}
+
+	package = getPackage(package_name, strict);
+	if (package == NULL)
+		return NULL;
+
+	variable = getVariableInternal(package, var_name, typid, is_record, strict);
+	if (variable != NULL)
+		cacheVariable(flinfo, package_name, var_name, slot, variable);
+
+	return variable;
+}
+
+/*
+ * Get the scalar variable to set its value. The package and the variable are
+ * created if they don't exist yet. The cached variable is used if it has been
+ * changed within the current (sub)transaction already, so there is no need to
+ * create savepoints.
+ */
+static Variable *
+getVariableToSet(FmgrInfo *flinfo, text *package_name, text *var_name,
+				 Oid typid, bool is_transactional)
+{
+	Variable  **slot;
 	Variable   *variable;
-	ScalarVar  *scalar;
+	Package    *package;
+
+	PERF_COUNT(variable_lookups, 1);
+	variable = findCachedVariable(flinfo, package_name, var_name, &slot);
+	if (variable != NULL &&
+		GetActualState(variable->package)->is_valid &&
+		isObjectChangedInCurrentTrans(&variable->package->transObject) &&
+		GetActualState(variable)->is_valid &&
+		variable->typid == typid && !variable->is_record &&
+		variable->is_transactional == is_transactional &&
+		(!is_transactional ||
+		 isObjectChangedInCurrentTrans(&variable->transObject)))
+	{
+		PERF_COUNT(lookup_cache_hits, 1);
+		if (slot != NULL)
+			cacheVariable(flinfo, package_name, var_name, slot, variable);
+		return variable;
+	}
 
 	package = createPackage(package_name, is_transactional);
 	variable = createVariableInternal(package, var_name, typid, false,
 									  is_transactional);
+	cacheVariable(flinfo, package_name, var_name, slot, variable);
 
-	scalar = &(GetActualValue(variable).scalar);
+	return variable;
+}
+
+/*
+ * Store the value into the scalar variable. If the new value fits into the
+ * memory of the previous one, the memory is reused. Otherwise the value is
+ * copied into ctx. Wide varlena values are compressed, see compress_value().
+ */
+static void
+storeScalarValue(ScalarVar *scalar, Datum value, bool is_null,
+				 MemoryContext ctx)
+{
+	Datum		compressed = (Datum) 0;
+
+	PERF_COUNT(scalar_sets, 1);
+
+	if (scalar->typlen == -1 && !is_null)
+	{
+		compressed = compress_value(value);
+		if (compressed != (Datum) 0)
+			value = compressed;
+	}
+
+	if (!scalar->typbyval && !is_null)
+	{
+		Size		size = datumGetSize(value, false, scalar->typlen);
+
+		PERF_COUNT(bytes_copied, size);
+
+		if (!scalar->is_null &&
+			(scalar->typlen != -1 ||
+			 !VARATT_IS_EXTERNAL_EXPANDED(DatumGetPointer(value))) &&
+			size <= datumGetSize(scalar->value, false, scalar->typlen))
+		{
+			release_memory(datumGetSize(scalar->value, false, scalar->typlen) -
+						   size);
+			/* The value may be the stored one itself */
+			memmove(DatumGetPointer(scalar->value),
+					DatumGetPointer(value), size);
+			if (compressed != (Datum) 0)
+				pfree(DatumGetPointer(compressed));
+			return;
+		}
+
+		/* Check the limit while the old value is still stored */
+		check_memory_limit(size);
+	}
 
 	/* Release memory for variable */
-	if (scalar->typbyval == false && scalar->is_null == false)
+	if (!scalar->typbyval && !scalar->is_null)
+	{
+		release_memory(datumGetSize(scalar->value, false, scalar->typlen));
 		pfree(DatumGetPointer(scalar->value));
+	}
 
 	scalar->is_null = is_null;
 	if (!scalar->is_null)
 	{
 		MemoryContext oldcxt;
 
-		oldcxt = MemoryContextSwitchTo(pack_hctx(package, is_transactional));
+		oldcxt = MemoryContextSwitchTo(ctx);
 		scalar->value = datumCopy(value, scalar->typbyval, scalar->typlen);
 		MemoryContextSwitchTo(oldcxt);
 	}
 	else
 		scalar->value = 0;
+
+	if (compressed != (Datum) 0)
+		pfree(DatumGetPointer(compressed));
 }
 
-static Datum
-variable_get(text *package_name, text *var_name,
-			 Oid typid, bool *is_null, bool strict)
+/*
+ * Set value of variable, typlen could be 0 if typbyval == true
+ */
+static void
+variable_set(FmgrInfo *flinfo, text *package_name, text *var_name,
+			 Oid typid, Datum value, bool is_null, bool is_transactional)
 {
 	Package    *package;
 	Variable   *variable;
 	ScalarVar  *scalar;
 
-	package = getPackage(package_name, strict);
-	if (package == NULL)
-	{
-		*is_null = true;
-		return 0;
-	}
+	variable = getVariableToSet(flinfo, package_name, var_name, typid,
+								is_transactional);
+	package = variable->package;
+
+	scalar = &(GetActualValue(variable).scalar);
+
+	storeScalarValue(scalar, value, is_null,
+					 pack_hctx(package, is_transactional));
+}
 
-	variable = getVariableInternal(package, var_name, typid, false, strict);
+static Datum
+variable_get(FmgrInfo *flinfo, text *package_name, text *var_name,
+			 Oid typid, bool *is_null, bool strict)
+{
+	Variable   *variable;
+	ScalarVar  *scalar;
 
+	PERF_COUNT(scalar_gets, 1);
+	variable = getVariable(flinfo, package_name, var_name, typid, false,
+						   strict);
 	if (variable == NULL)
 	{
 		*is_null = true;
@@ -671,7 +1039,7 @@ variable_get(text *package_name, text *var_name,
 		var_name = PG_GETARG_TEXT_PP(var_arg); \
 		strict = PG_GETARG_BOOL(strict_arg); \
 		\
-		value = variable_get(package_name, var_name, \
+		value = variable_get(fcinfo->flinfo, package_name, var_name, \
 							 (typid), &isnull, strict); \
 		\
 		PG_FREE_IF_COPY(package_name, pkg_arg); \
@@ -712,7 +1080,7 @@ VARIABLE_GET_TEMPLATE(0, 1, 3, array, get_fn_expr_argtype(fcinfo->flinfo, 2))
 		var_name = PG_GETARG_TEXT_PP(1); \
 		is_transactional = PG_GETARG_BOOL(3); \
 		\
-		variable_set(package_name, var_name, (typid), \
+		variable_set(fcinfo->flinfo, package_name, var_name, (typid), \
 					 PG_ARGISNULL(2) ? 0 : PG_GETARG_DATUM(2), \
 					 PG_ARGISNULL(2), is_transactional); \
 		\
@@ -736,64 +1104,193 @@ VARIABLE_SET_TEMPLATE(any, get_fn_expr_argtype(fcinfo->flinfo, 2))
 VARIABLE_SET_TEMPLATE(array, get_fn_expr_argtype(fcinfo->flinfo, 2))
 
 
+/* Call info of pgv_incr(), it extends the variable handle */
+typedef struct IncrCallInfo
+{
+	VariableHandle handle;
+	/* Type of the delta and the function of its "+" operator */
+	Oid			typid;
+	FmgrInfo	add_proc;
+}			IncrCallInfo;
+
+/*
+ * Add the delta to the scalar variable and return the new value. The variable
+ * is created if it doesn't exist yet, NULL value is replaced by the delta.
+ */
 Datum
-variable_insert(PG_FUNCTION_ARGS)
+variable_incr(PG_FUNCTION_ARGS)
 {
 	text	   *package_name;
 	text	   *var_name;
-	HeapTupleHeader rec;
-	Package    *package;
-	Variable   *variable;
+	Oid			typid;
+	Datum		delta;
 	bool		is_transactional;
+	IncrCallInfo *info;
+	Variable   *variable;
+	ScalarVar  *scalar;
+	Datum		value;
 
-	Oid			tupType;
-	int32		tupTypmod;
-	TupleDesc	tupdesc = NULL;
-	RecordVar  *record;
-
-	/* Checks */
 	CHECK_ARGS_FOR_NULL();
 
 	if (PG_ARGISNULL(2))
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("record argument can not be NULL")));
+				 errmsg("delta can not be NULL")));
 
-	/* Get arguments */
 	package_name = PG_GETARG_TEXT_PP(0);
 	var_name = PG_GETARG_TEXT_PP(1);
-	rec = PG_GETARG_HEAPTUPLEHEADER(2);
+	typid = get_fn_expr_argtype(fcinfo->flinfo, 2);
+	delta = PG_GETARG_DATUM(2);
 	is_transactional = PG_GETARG_BOOL(3);
 
-	/* Get cached package */
-	if (LastPackage == NULL ||
-		VARSIZE_ANY_EXHDR(package_name) != strlen(GetName(LastPackage)) ||
-		strncmp(VARDATA_ANY(package_name), GetName(LastPackage),
-				VARSIZE_ANY_EXHDR(package_name)) != 0 ||
-		!pack_htab(LastPackage, is_transactional))
+	/* Look up the "+" operator once per call site */
+	info = (IncrCallInfo *) fcinfo->flinfo->fn_extra;
+	if (info == NULL)
+		info = (IncrCallInfo *) initVariableHandle(fcinfo->flinfo,
+												   sizeof(IncrCallInfo));
+	if (info->typid != typid)
 	{
-		package = createPackage(package_name, is_transactional);
-		LastPackage = package;
-		LastVariable = NULL;
+		Oid			oprid;
+
+		oprid = OpernameGetOprid(list_make1(makeString("+")), typid, typid);
+		if (!OidIsValid(oprid))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("operator does not exist: %s + %s",
+							format_type_be(typid), format_type_be(typid))));
+
+		fmgr_info_cxt(get_opcode(oprid), &info->add_proc,
+					  fcinfo->flinfo->fn_mcxt);
+		info->typid = typid;
+	}
+
+	variable = getVariableToSet(fcinfo->flinfo, package_name, var_name, typid,
+								is_transactional);
+	scalar = &(GetActualValue(variable).scalar);
+
+	if (scalar->is_null)
+		value = delta;
+	else
+		value = FunctionCall2Coll(&info->add_proc, PG_GET_COLLATION(),
+								  scalar->value, delta);
+	storeScalarValue(scalar, value, false,
+					 pack_hctx(variable->package, is_transactional));
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_DATUM(scalar->value);
+}
+
+/*
+ * Append the text to the text variable. The variable is created if it doesn't
+ * exist yet, NULL value is replaced by the text.
+ */
+Datum
+variable_append(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	text	   *str;
+	bool		is_transactional;
+	Variable   *variable;
+	ScalarVar  *scalar;
+	MemoryContext ctx;
+
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("value can not be NULL")));
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	str = PG_GETARG_TEXT_PP(2);
+	is_transactional = PG_GETARG_BOOL(3);
+
+	variable = getVariableToSet(fcinfo->flinfo, package_name, var_name,
+								TEXTOID, is_transactional);
+	scalar = &(GetActualValue(variable).scalar);
+	ctx = pack_hctx(variable->package, is_transactional);
+
+	if (scalar->is_null)
+		storeScalarValue(scalar, PointerGetDatum(str), false, ctx);
+	else if (VARATT_IS_4B_U(DatumGetPointer(scalar->value)) &&
+			 (compression_threshold == 0 ||
+			  VARSIZE(DatumGetPointer(scalar->value)) + VARSIZE_ANY_EXHDR(str) <=
+			  (Size) compression_threshold))
+	{
+		/* Append to the stored value, its memory may be enlarged in place */
+		text	   *cur = (text *) DatumGetPointer(scalar->value);
+		Size		curlen = VARSIZE(cur);
+		Size		len = VARSIZE_ANY_EXHDR(str);
+
+		/* The text may be the stored value itself */
+		if (str == cur)
+			str = (text *) DatumGetPointer(datumCopy(PointerGetDatum(str),
+													 false, -1));
+
+		check_memory_limit(len);
+		cur = (text *) repalloc(cur, curlen + len);
+		memcpy((char *) cur + curlen, VARDATA_ANY(str), len);
+		SET_VARSIZE(cur, curlen + len);
+		scalar->value = PointerGetDatum(cur);
 	}
 	else
-		package = LastPackage;
+	{
+		/*
+		 * The stored value is short or compressed, or the result should be
+		 * compressed, make a new one
+		 */
+		Datum		value = DirectFunctionCall2(textcat, scalar->value,
+												PointerGetDatum(str));
+
+		storeScalarValue(scalar, value, false, ctx);
+	}
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+	PG_FREE_IF_COPY(str, 2);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * Get the record variable to insert records into. The package and the variable
+ * are created if they don't exist yet. Recently used variables are cached to
+ * speed up consecutive inserts into the same variable.
+ */
+static Variable *
+getVariableToInsert(FmgrInfo *flinfo, text *package_name, text *var_name,
+					bool is_transactional)
+{
+	Variable  **slot;
+	Variable   *variable;
 
-	/* Get cached variable */
-	if (LastVariable == NULL ||
-		VARSIZE_ANY_EXHDR(var_name) != strlen(GetName(LastVariable)) ||
-		strncmp(VARDATA_ANY(var_name), GetName(LastVariable),
-				VARSIZE_ANY_EXHDR(var_name)) != 0)
+	variable = findCachedVariable(flinfo, package_name, var_name, &slot);
+	if (variable == NULL ||
+		!GetActualState(variable->package)->is_valid ||
+		!pack_htab(variable->package, is_transactional) ||
+		!GetActualState(variable)->is_valid ||
+		variable->typid != RECORDOID || !variable->is_record)
 	{
+		Package    *package;
+
+		package = createPackage(package_name, is_transactional);
 		variable = createVariableInternal(package, var_name, RECORDOID,
 										  true, is_transactional);
-		LastVariable = variable;
+		cacheVariable(flinfo, package_name, var_name, slot, variable);
 	}
 	else
 	{
 		TransObject *transObj;
 
-		if (LastVariable->is_transactional != is_transactional)
+		if (slot != NULL)
+			cacheVariable(flinfo, package_name, var_name, slot, variable);
+
+		if (variable->is_transactional != is_transactional)
 		{
 			char		key[NAMEDATALEN];
 
@@ -801,10 +1298,9 @@ variable_insert(PG_FUNCTION_ARGS)
 			ereport(ERROR,
 					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 					 errmsg("variable \"%s\" already created as %sTRANSACTIONAL",
-							key, LastVariable->is_transactional ? "" : "NOT ")));
+							key, variable->is_transactional ? "" : "NOT ")));
 		}
 
-		variable = LastVariable;
 		transObj = &variable->transObject;
 
 		if (variable->is_transactional &&
@@ -815,28 +1311,39 @@ variable_insert(PG_FUNCTION_ARGS)
 		}
 	}
 
-	/* Insert a record */
-	tupType = HeapTupleHeaderGetTypeId(rec);
-	tupTypmod = HeapTupleHeaderGetTypMod(rec);
+	return variable;
+}
 
-	record = &(GetActualValue(variable).record);
-	tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
+/*
+ * Initialize the variable by the first record or check that the record has
+ * the structure of the variable. rec may be replaced by a coerced copy.
+ * nrows is the expected number of records.
+ */
+static void
+prepareRecordToInsert(Variable *variable, HeapTupleHeader *rec,
+					  TupleDesc tupdesc, long nrows)
+{
+	RecordVar  *record = &(GetActualValue(variable).record);
 
 	if (!record->tupdesc || variable->is_deleted)
 	{
+		TupleDesc	init_tupdesc;
+
 		/*
 		 * This is the first record for the var_name. Initialize record.
+		 *
+		 * Convert UNKNOWNOID to TEXTOID if needed. init_tupdesc may be
+		 * changed, so get own reference to the tuple descriptor.
 		 */
-		/* Convert UNKNOWNOID to TEXTOID if needed
-		 * tupdesc may be changed
-		 */
+		init_tupdesc = lookup_rowtype_tupdesc(tupdesc->tdtypeid,
+											  tupdesc->tdtypmod);
 		if (convert_unknownoid)
-		{
-			coerce_unknown_first_record(&tupdesc, &rec);
-		}
+			coerce_unknown_first_record(&init_tupdesc, rec);
 
-		init_record(record, tupdesc, variable);
+		init_record(record, init_tupdesc, variable, nrows);
 		variable->is_deleted = false;
+
+		ReleaseTupleDesc(init_tupdesc);
 	}
 	else
 	{
@@ -844,17 +1351,53 @@ variable_insert(PG_FUNCTION_ARGS)
 		 * We need to check attributes of the new row if this is a transient
 		 * record type or if last record has different id.
 		 * Also we convert UNKNOWNOID to TEXTOID if needed.
-		 * tupdesc may be changed
+		 * rec may be changed
 		 */
-		check_attributes(variable, &rec, tupdesc);
-
+		check_attributes(variable, rec, tupdesc);
 	}
+}
+
+Datum
+variable_insert(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	HeapTupleHeader rec;
+	Variable   *variable;
+	bool		is_transactional;
+
+	Oid			tupType;
+	int32		tupTypmod;
+	TupleDesc	tupdesc;
+
+	/* Checks */
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("record argument can not be NULL")));
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	rec = PG_GETARG_HEAPTUPLEHEADER(2);
+	is_transactional = PG_GETARG_BOOL(3);
+
+	variable = getVariableToInsert(fcinfo->flinfo, package_name, var_name,
+								   is_transactional);
+
+	/* Insert a record */
+	tupType = HeapTupleHeaderGetTypeId(rec);
+	tupTypmod = HeapTupleHeaderGetTypMod(rec);
+
+	tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
 
+	prepareRecordToInsert(variable, &rec, tupdesc, 0);
 	insert_record(variable, rec);
 
 	/* Release resources */
-	if (tupdesc)
-		ReleaseTupleDesc(tupdesc);
+	ReleaseTupleDesc(tupdesc);
 
 	PG_FREE_IF_COPY(package_name, 0);
 	PG_FREE_IF_COPY(var_name, 1);
@@ -862,19 +1405,30 @@ variable_insert(PG_FUNCTION_ARGS)
 	PG_RETURN_VOID();
 }
 
-Datum
-variable_update(PG_FUNCTION_ARGS)
+/*
+ * Insert all records of the array into the variable, or replace the records
+ * with the same keys if upsert is true. The structure of records is checked
+ * once per record type, the records hash of a new variable is created for the
+ * number of the array elements. Returns the number of inserted records.
+ */
+static int64
+insertRecordsArray(FunctionCallInfo fcinfo, bool upsert)
 {
 	text	   *package_name;
 	text	   *var_name;
-	HeapTupleHeader rec;
-	Package    *package;
+	ArrayType  *records;
 	Variable   *variable;
-	TransObject *transObject;
-	bool		res;
-	Oid			tupType;
-	int32		tupTypmod;
+	bool		is_transactional;
+	int			nitems;
+	ArrayIterator iterator;
+	Datum		value;
+	bool		isnull;
+	int64		ninserted = 0;
+
+	Oid			tupType = InvalidOid;
+	int32		tupTypmod = -1;
 	TupleDesc	tupdesc = NULL;
+	bool		check_each = false;
 
 	/* Checks */
 	CHECK_ARGS_FOR_NULL();
@@ -882,123 +1436,120 @@ variable_update(PG_FUNCTION_ARGS)
 	if (PG_ARGISNULL(2))
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("record argument can not be NULL")));
+				 errmsg("array argument can not be NULL")));
 
 	/* Get arguments */
 	package_name = PG_GETARG_TEXT_PP(0);
 	var_name = PG_GETARG_TEXT_PP(1);
-	rec = PG_GETARG_HEAPTUPLEHEADER(2);
+	records = PG_GETARG_ARRAYTYPE_P(2);
+	is_transactional = PG_GETARG_BOOL(3);
 
-	/* Get cached package */
-	if (LastPackage == NULL ||
-		VARSIZE_ANY_EXHDR(package_name) != strlen(GetName(LastPackage)) ||
-		strncmp(VARDATA_ANY(package_name), GetName(LastPackage),
-				VARSIZE_ANY_EXHDR(package_name)) != 0)
-	{
-		package = getPackage(package_name, true);
-		LastPackage = package;
-		LastVariable = NULL;
-	}
-	else
-		package = LastPackage;
+	if (!type_is_rowtype(ARR_ELEMTYPE(records)))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("array argument should contain records")));
 
-	/* Get cached variable */
-	if (LastVariable == NULL ||
-		VARSIZE_ANY_EXHDR(var_name) != strlen(GetName(LastVariable)) ||
-		strncmp(VARDATA_ANY(var_name), GetName(LastVariable),
-				VARSIZE_ANY_EXHDR(var_name)) != 0)
+	nitems = ArrayGetNItems(ARR_NDIM(records), ARR_DIMS(records));
+	/* Nothing to insert, don't create the variable */
+	if (nitems == 0)
 	{
-		variable = getVariableInternal(package, var_name, RECORDOID, true,
-									   true);
-		LastVariable = variable;
+		PG_FREE_IF_COPY(package_name, 0);
+		PG_FREE_IF_COPY(var_name, 1);
+		return 0;
 	}
-	else
-		variable = LastVariable;
 
-	transObject = &variable->transObject;
-	if (variable->is_transactional &&
-		!isObjectChangedInCurrentTrans(transObject))
+	variable = getVariableToInsert(fcinfo->flinfo, package_name, var_name,
+								   is_transactional);
+
+	iterator = array_create_iterator(records, 0, NULL);
+	while (array_iterate(iterator, &value, &isnull))
 	{
-		createSavepoint(transObject, TRANS_VARIABLE);
-		addToChangesStack(transObject, TRANS_VARIABLE);
-	}
+		HeapTupleHeader rec;
 
-	/* Update a record */
-	tupType = HeapTupleHeaderGetTypeId(rec);
-	tupTypmod = HeapTupleHeaderGetTypMod(rec);
+		if (isnull)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("record argument can not be NULL")));
 
-	tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
-	/*
-	 * Convert UNKNOWNOID to TEXTOID if needed
-	 * tupdesc may be changed
-	 */
-	check_attributes(variable, &rec, tupdesc);
-	ReleaseTupleDesc(tupdesc);
+		rec = DatumGetHeapTupleHeader(value);
 
-	res = update_record(variable, rec);
+		/*
+		 * Elements of an array of anonymous records may have different
+		 * types, check the structure of a record only if its type differs
+		 * from the previous one.
+		 */
+		if (tupdesc == NULL || check_each ||
+			HeapTupleHeaderGetTypeId(rec) != tupType ||
+			HeapTupleHeaderGetTypMod(rec) != tupTypmod)
+		{
+			if (tupdesc)
+				ReleaseTupleDesc(tupdesc);
+
+			tupType = HeapTupleHeaderGetTypeId(rec);
+			tupTypmod = HeapTupleHeaderGetTypMod(rec);
+			tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
+
+			/* Records with unknown attributes are coerced one by one */
+			check_each = convert_unknownoid &&
+				is_unknownoid_in_tupdesc(tupdesc);
+
+			prepareRecordToInsert(variable, &rec, tupdesc, nitems);
+		}
+
+		if (!upsert)
+		{
+			insert_record(variable, rec);
+			ninserted++;
+		}
+		else if (upsert_record(variable, rec))
+			ninserted++;
+	}
+	array_free_iterator(iterator);
 
 	/* Release resources */
+	if (tupdesc)
+		ReleaseTupleDesc(tupdesc);
+
 	PG_FREE_IF_COPY(package_name, 0);
 	PG_FREE_IF_COPY(var_name, 1);
 
-	PG_RETURN_BOOL(res);
+	return ninserted;
 }
 
 Datum
-variable_delete(PG_FUNCTION_ARGS)
+variable_insert_all(PG_FUNCTION_ARGS)
+{
+	insertRecordsArray(fcinfo, false);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Prepare the record variable to store the expected number of records.
+ */
+Datum
+variable_reserve(PG_FUNCTION_ARGS)
 {
 	text	   *package_name;
 	text	   *var_name;
-	Oid			value_type;
-	Datum		value;
-	bool		value_is_null = PG_ARGISNULL(2);
-	Package    *package;
+	int64		nrows;
 	Variable   *variable;
 	TransObject *transObject;
-	bool		res;
 
 	CHECK_ARGS_FOR_NULL();
 
+	if (PG_ARGISNULL(2) || PG_GETARG_INT64(2) < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of records should be non-negative")));
+
 	/* Get arguments */
 	package_name = PG_GETARG_TEXT_PP(0);
 	var_name = PG_GETARG_TEXT_PP(1);
+	nrows = Min(PG_GETARG_INT64(2), (int64) PG_INT32_MAX);
 
-	if (!value_is_null)
-	{
-		value_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
-		value = PG_GETARG_DATUM(2);
-	}
-	else
-	{
-		value_type = InvalidOid;
-		value = 0;
-	}
-
-	/* Get cached package */
-	if (LastPackage == NULL ||
-		VARSIZE_ANY_EXHDR(package_name) != strlen(GetName(LastPackage)) ||
-		strncmp(VARDATA_ANY(package_name), GetName(LastPackage),
-				VARSIZE_ANY_EXHDR(package_name)) != 0)
-	{
-		package = getPackage(package_name, true);
-		LastPackage = package;
-		LastVariable = NULL;
-	}
-	else
-		package = LastPackage;
-
-	/* Get cached variable */
-	if (LastVariable == NULL ||
-		VARSIZE_ANY_EXHDR(var_name) != strlen(GetName(LastVariable)) ||
-		strncmp(VARDATA_ANY(var_name), GetName(LastVariable),
-				VARSIZE_ANY_EXHDR(var_name)) != 0)
-	{
-		variable = getVariableInternal(package, var_name, RECORDOID, true,
-									   true);
-		LastVariable = variable;
-	}
-	else
-		variable = LastVariable;
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
 
 	transObject = &variable->transObject;
 	if (variable->is_transactional &&
@@ -1008,27 +1559,26 @@ variable_delete(PG_FUNCTION_ARGS)
 		addToChangesStack(transObject, TRANS_VARIABLE);
 	}
 
-	/* Delete a record */
-	if (!value_is_null)
-		check_record_key(variable, value_type);
-	res = delete_record(variable, value, value_is_null);
+	/* Running scans of the records hash can't proceed with a new one */
+	remove_variables_variable(&variables_stats, variable);
+	reserve_record(variable, (long) nrows);
 
 	/* Release resources */
 	PG_FREE_IF_COPY(package_name, 0);
 	PG_FREE_IF_COPY(var_name, 1);
 
-	PG_RETURN_BOOL(res);
+	PG_RETURN_VOID();
 }
 
+/*
+ * Create the ordered index of records of the variable. It is maintained until
+ * the variable is removed or its records are reinitialized.
+ */
 Datum
-variable_select(PG_FUNCTION_ARGS)
+variable_create_ordered_index(PG_FUNCTION_ARGS)
 {
-	FuncCallContext *funcctx;
-	HASH_SEQ_STATUS *rstat;
-	HashRecordEntry *item;
 	text	   *package_name;
 	text	   *var_name;
-	Package    *package;
 	Variable   *variable;
 
 	CHECK_ARGS_FOR_NULL();
@@ -1037,816 +1587,3384 @@ variable_select(PG_FUNCTION_ARGS)
 	package_name = PG_GETARG_TEXT_PP(0);
 	var_name = PG_GETARG_TEXT_PP(1);
 
-	package = getPackage(package_name, true);
-	variable = getVariableInternal(package, var_name, RECORDOID, true,
-								   true);
-
-	if (SRF_IS_FIRSTCALL())
-	{
-		MemoryContext oldcontext;
-		RecordVar  *record;
-		VariableStatEntry *entry;
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
 
-		record = &(GetActualValue(variable).record);
-		funcctx = SRF_FIRSTCALL_INIT();
+	create_record_index(&(GetActualValue(variable).record));
 
-		oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+	/* Release resources */
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
 
-		funcctx->tuple_desc = record->tupdesc;
+	PG_RETURN_VOID();
+}
 
-		rstat = (HASH_SEQ_STATUS *) palloc0(sizeof(HASH_SEQ_STATUS));
-		hash_seq_init(rstat, record->rhash);
-		funcctx->user_fctx = rstat;
+/*
+ * Check that the attribute number is valid for the record variable.
+ */
+static void
+checkRecordAttnum(Variable *variable, int32 attnum)
+{
+	RecordVar  *record = &(GetActualValue(variable).record);
 
-		entry = palloc0(sizeof(VariableStatEntry));
-		entry->hash = record->rhash;
-		entry->status = rstat;
-		entry->variable = variable;
-		entry->package = package;
-		entry->levels.level = GetCurrentTransactionNestLevel();
-#ifdef PGPRO_EE
-		entry->levels.atxlevel = getNestLevelATX();
-#endif
-		entry->user_fctx = &funcctx->user_fctx;
-		variables_stats = lcons((void *) entry, variables_stats);
+	if (attnum < 1 || attnum > record->tupdesc->natts)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("attribute number %d is out of range for variable "
+						"\"%s\"", attnum, GetName(variable))));
+}
 
-		MemoryContextSwitchTo(oldcontext);
-		PG_FREE_IF_COPY(package_name, 0);
-		PG_FREE_IF_COPY(var_name, 1);
-	}
+/*
+ * Check that the requested type is the type of the attribute of records of
+ * the variable, attnum starts from 1.
+ */
+static void
+checkRecordAttType(Variable *variable, int32 attnum, Oid typid)
+{
+	RecordVar  *record = &(GetActualValue(variable).record);
 
-	funcctx = SRF_PERCALL_SETUP();
+	if (GetTupleDescAttr(record->tupdesc, attnum - 1)->atttypid != typid)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("requested value type differs from variable \"%s\" "
+						"attribute %d type", GetName(variable), attnum)));
+}
+
+/*
+ * Create the hash index of records of the variable by the attribute. The key
+ * attribute is always indexed by the records hash.
+ */
+Datum
+variable_create_index(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	int32		attnum;
+	Variable   *variable;
+
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("attribute number can not be NULL")));
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	attnum = PG_GETARG_INT32(2);
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
+
+	checkRecordAttnum(variable, attnum);
+	if (attnum > 1)
+		create_record_hash_index(&(GetActualValue(variable).record),
+								 attnum - 1);
+
+	/* Release resources */
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_VOID();
+}
+
+Datum
+variable_update(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	HeapTupleHeader rec;
+	Variable   *variable;
+	TransObject *transObject;
+	bool		res;
+	Oid			tupType;
+	int32		tupTypmod;
+	TupleDesc	tupdesc = NULL;
+
+	/* Checks */
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("record argument can not be NULL")));
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	rec = PG_GETARG_HEAPTUPLEHEADER(2);
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
+
+	transObject = &variable->transObject;
+	if (variable->is_transactional &&
+		!isObjectChangedInCurrentTrans(transObject))
+	{
+		createSavepoint(transObject, TRANS_VARIABLE);
+		addToChangesStack(transObject, TRANS_VARIABLE);
+	}
+
+	/* Update a record */
+	tupType = HeapTupleHeaderGetTypeId(rec);
+	tupTypmod = HeapTupleHeaderGetTypMod(rec);
+
+	tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
+	/*
+	 * Convert UNKNOWNOID to TEXTOID if needed
+	 * tupdesc may be changed
+	 */
+	check_attributes(variable, &rec, tupdesc);
+	ReleaseTupleDesc(tupdesc);
+
+	res = update_record(variable, rec);
+
+	/* Release resources */
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_BOOL(res);
+}
+
+/*
+ * Insert the record or replace the record with the same key.
+ */
+Datum
+variable_upsert(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	HeapTupleHeader rec;
+	Variable   *variable;
+	bool		is_transactional;
+	bool		res;
+
+	Oid			tupType;
+	int32		tupTypmod;
+	TupleDesc	tupdesc;
+
+	/* Checks */
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("record argument can not be NULL")));
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	rec = PG_GETARG_HEAPTUPLEHEADER(2);
+	is_transactional = PG_GETARG_BOOL(3);
+
+	variable = getVariableToInsert(fcinfo->flinfo, package_name, var_name,
+								   is_transactional);
+
+	tupType = HeapTupleHeaderGetTypeId(rec);
+	tupTypmod = HeapTupleHeaderGetTypMod(rec);
+
+	tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
+
+	prepareRecordToInsert(variable, &rec, tupdesc, 0);
+	res = upsert_record(variable, rec);
+
+	/* Release resources */
+	ReleaseTupleDesc(tupdesc);
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_BOOL(res);
+}
+
+/*
+ * Insert all records of the array, replacing the records with the same keys.
+ */
+Datum
+variable_upsert_all(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64(insertRecordsArray(fcinfo, true));
+}
+
+Datum
+variable_delete(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Oid			value_type;
+	Datum		value;
+	bool		value_is_null = PG_ARGISNULL(2);
+	Variable   *variable;
+	TransObject *transObject;
+	bool		res;
+
+	CHECK_ARGS_FOR_NULL();
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	if (!value_is_null)
+	{
+		value_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
+		value = PG_GETARG_DATUM(2);
+	}
+	else
+	{
+		value_type = InvalidOid;
+		value = 0;
+	}
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
+
+	transObject = &variable->transObject;
+	if (variable->is_transactional &&
+		!isObjectChangedInCurrentTrans(transObject))
+	{
+		createSavepoint(transObject, TRANS_VARIABLE);
+		addToChangesStack(transObject, TRANS_VARIABLE);
+	}
+
+	/* Delete a record */
+	if (!value_is_null)
+		check_record_key(variable, value_type);
+	res = delete_record(variable, value, value_is_null);
+
+	/* Release resources */
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_BOOL(res);
+}
+
+/*
+ * Delete records with all keys of the array and return the number of deleted
+ * records. The key type is checked once for the whole array.
+ */
+Datum
+variable_delete_all(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	ArrayType  *values;
+	Variable   *variable;
+	TransObject *transObject;
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	int16		elmlen;
+	bool		elmbyval;
+	char		elmalign;
+	int			i;
+	int64		res = 0;
+
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("array argument can not be NULL")));
+
+	values = PG_GETARG_ARRAYTYPE_P(2);
+	if (ARR_NDIM(values) > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("deleting by elements of multidimensional arrays is not supported")));
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
+	check_record_key(variable, ARR_ELEMTYPE(values));
+
+	transObject = &variable->transObject;
+	if (variable->is_transactional &&
+		!isObjectChangedInCurrentTrans(transObject))
+	{
+		createSavepoint(transObject, TRANS_VARIABLE);
+		addToChangesStack(transObject, TRANS_VARIABLE);
+	}
+
+	get_typlenbyvalalign(ARR_ELEMTYPE(values), &elmlen, &elmbyval, &elmalign);
+	deconstruct_array(values, ARR_ELEMTYPE(values), elmlen, elmbyval,
+					  elmalign, &elems, &nulls, &nelems);
+
+	for (i = 0; i < nelems; i++)
+		res += delete_record(variable, elems[i], nulls[i]);
+
+	pfree(elems);
+	pfree(nulls);
+
+	/* Release resources */
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_INT64(res);
+}
+
+/*
+ * Remove all records of the variable. The variable keeps its structure and
+ * indexes.
+ */
+Datum
+variable_truncate(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Variable   *variable;
+	TransObject *transObject;
+
+	CHECK_ARGS_FOR_NULL();
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
+
+	transObject = &variable->transObject;
+	if (variable->is_transactional &&
+		!isObjectChangedInCurrentTrans(transObject))
+	{
+		createSavepoint(transObject, TRANS_VARIABLE);
+		addToChangesStack(transObject, TRANS_VARIABLE);
+	}
+
+	/* Running scans of the records hash can't proceed after truncation */
+	remove_variables_variable(&variables_stats, variable);
+	truncate_record(variable);
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Check if the set-returning function can return its result in materialize
+ * mode.
+ */
+#define MaterializeAllowed(fcinfo) \
+	((fcinfo)->resultinfo != NULL && \
+	 IsA((fcinfo)->resultinfo, ReturnSetInfo) && \
+	 (((ReturnSetInfo *) (fcinfo)->resultinfo)->allowedModes & SFRM_Materialize))
+
+/*
+ * Table functions in FROM clause fetch all the records before returning the
+ * first one anyway, so it is better to return them at once. Otherwise records
+ * are returned one by one, so that LIMIT or a cursor can stop the scan early.
+ */
+#define MaterializePreferred(fcinfo) \
+	(MaterializeAllowed(fcinfo) && \
+	 ((ReturnSetInfo *) (fcinfo)->resultinfo)->expectedDesc != NULL)
+
+/*
+ * Prepare the tuplestore to return records of tupdesc in materialize mode.
+ */
+static Tuplestorestate *
+beginMaterializedResult(FunctionCallInfo fcinfo, TupleDesc tupdesc)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext oldcontext;
+	Tuplestorestate *tupstore;
+
+	Assert(MaterializeAllowed(fcinfo));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+									 false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = CreateTupleDescCopy(tupdesc);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return tupstore;
+}
+
+/*
+ * Put the record tuple into the tuplestore, it is copied.
+ */
+static inline void
+putRecordTuple(Tuplestorestate *tupstore, Datum tuple)
+{
+	HeapTupleData tup;
+
+	Assert(!HeapTupleHeaderHasExternal((HeapTupleHeader) DatumGetPointer(tuple)));
+
+	tup.t_len = HeapTupleHeaderGetDatumLength((HeapTupleHeader) DatumGetPointer(tuple));
+	ItemPointerSetInvalid(&(tup.t_self));
+	tup.t_tableOid = InvalidOid;
+	tup.t_data = (HeapTupleHeader) DatumGetPointer(tuple);
+
+	tuplestore_puttuple(tupstore, &tup);
+	PERF_COUNT(records_returned, 1);
+}
+
+/*
+ * Return records of the variable at once in materialize mode. If iscan is
+ * given, it is the ordered scan of records to return, otherwise all the
+ * records are returned in order of the records hash.
+ */
+static void
+selectRecordsMaterialized(FunctionCallInfo fcinfo, RecordVar *record,
+						  RecordIndexScan *iscan)
+{
+	Tuplestorestate *tupstore;
+	Datum		tuple;
+
+	tupstore = beginMaterializedResult(fcinfo, record->tupdesc);
+
+	if (iscan)
+	{
+		while (record_index_next(iscan, &tuple))
+			putRecordTuple(tupstore, tuple);
+	}
+	else
+	{
+		HASH_SEQ_STATUS rstat;
+		HashRecordEntry *item;
+
+		hash_seq_init(&rstat, record->rhash);
+		while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+			putRecordTuple(tupstore, item->tuple);
+	}
+}
+
+/* Structure for variable_select() and variable_select_range() */
+typedef struct
+{
+	HASH_SEQ_STATUS *rstat;		/* scan of the records hash */
+	RecordIndexScan *iscan;		/* ordered scan if the variable has index */
+	VariableStatEntry *stat;	/* entry of variables_stats for the scan */
+}			RecordScanRec;
+
+/*
+ * Remember the scan of records to stop it if the variable is removed, see
+ * comments for variables_stats.
+ */
+static void
+addVariableStatEntry(FuncCallContext *funcctx, Variable *variable,
+					 RecordScanRec *scan)
+{
+	MemoryContext oldcontext;
+	VariableStatEntry *entry;
+
+	oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+
+	entry = palloc0(sizeof(VariableStatEntry));
+	entry->hash = GetActualValue(variable).record.rhash;
+	entry->status = scan->rstat;
+	entry->variable = variable;
+	entry->package = variable->package;
+	entry->levels.level = GetCurrentTransactionNestLevel();
+#ifdef PGPRO_EE
+	entry->levels.atxlevel = getNestLevelATX();
+#endif
+	entry->user_fctx = &funcctx->user_fctx;
+	dlist_push_head(&variables_stats, &entry->node);
+	scan->stat = entry;
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Get the next record of the scan. Returns false if the scan is finished.
+ */
+static bool
+recordScanNext(FuncCallContext *funcctx, Datum *tuple)
+{
+	RecordScanRec *scan = (RecordScanRec *) funcctx->user_fctx;
+	HashRecordEntry *item;
+
+	if (scan == NULL)
+	{
+		/*
+		 * VariableStatEntry was removed. For example, after call
+		 * 'ROLLBACK TO SAVEPOINT ...'
+		 */
+		return false;
+	}
+
+	if (scan->iscan)
+	{
+		if (record_index_next(scan->iscan, tuple))
+		{
+			PERF_COUNT(records_returned, 1);
+			return true;
+		}
+
+		removeVariableStatEntry(scan->stat);
+		return false;
+	}
+
+	/* Get next hash record */
+	item = (HashRecordEntry *) hash_seq_search(scan->rstat);
+	if (item != NULL)
+	{
+		*tuple = item->tuple;
+		PERF_COUNT(records_returned, 1);
+		return true;
+	}
+
+	removeVariableStatEntry(scan->stat);
+	return false;
+}
+
+Datum
+variable_select(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	Datum		tuple;
+	text	   *package_name;
+	text	   *var_name;
+	Variable   *variable;
+
+	CHECK_ARGS_FOR_NULL();
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	variable = getVariable(NULL, package_name, var_name, RECORDOID,
+						   true, true);
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		RecordVar  *record;
+		RecordScanRec *scan;
+		HASH_SEQ_STATUS *rstat = NULL;
+
+		record = &(GetActualValue(variable).record);
+
+		if (MaterializePreferred(fcinfo))
+		{
+			RecordIndexScan *iscan = NULL;
+
+			/* Return records in order of keys if it is possible */
+			if (record->index)
+				iscan = record_index_begin(record, (Datum) 0, false,
+										   (Datum) 0, false, false);
+			selectRecordsMaterialized(fcinfo, record, iscan);
+
+			PG_FREE_IF_COPY(package_name, 0);
+			PG_FREE_IF_COPY(var_name, 1);
+			return (Datum) 0;
+		}
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		funcctx->tuple_desc = record->tupdesc;
+
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+		scan = (RecordScanRec *) palloc0(sizeof(RecordScanRec));
+		/* Return records in order of keys if it is possible */
+		if (record->index)
+			scan->iscan = record_index_begin(record, (Datum) 0, false,
+											 (Datum) 0, false, false);
+		else
+		{
+			MemoryContextSwitchTo(TopTransactionContext);
+			rstat = (HASH_SEQ_STATUS *) palloc0(sizeof(HASH_SEQ_STATUS));
+			hash_seq_init(rstat, record->rhash);
+			scan->rstat = rstat;
+		}
+		funcctx->user_fctx = scan;
+		MemoryContextSwitchTo(oldcontext);
+
+		addVariableStatEntry(funcctx, variable, scan);
+
+		PG_FREE_IF_COPY(package_name, 0);
+		PG_FREE_IF_COPY(var_name, 1);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+
+	if (recordScanNext(funcctx, &tuple))
+	{
+		Assert(!HeapTupleHeaderHasExternal(
+										   (HeapTupleHeader) DatumGetPointer(tuple)));
+
+		SRF_RETURN_NEXT(funcctx, tuple);
+	}
+	else
+		SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Return records of the variable with keys between lo and hi, in order of
+ * keys. NULL bound means there is no bound.
+ */
+Datum
+variable_select_range(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	Datum		tuple;
+	text	   *package_name;
+	text	   *var_name;
+	Variable   *variable;
+
+	CHECK_ARGS_FOR_NULL();
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	variable = getVariable(NULL, package_name, var_name, RECORDOID,
+						   true, true);
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		RecordVar  *record;
+		RecordScanRec *scan;
+		bool		has_lo = !PG_ARGISNULL(2);
+		bool		has_hi = !PG_ARGISNULL(3);
+		Datum		lo = has_lo ? PG_GETARG_DATUM(2) : (Datum) 0;
+		Datum		hi = has_hi ? PG_GETARG_DATUM(3) : (Datum) 0;
+
+		record = &(GetActualValue(variable).record);
+
+		if (has_lo)
+			check_record_key(variable, get_fn_expr_argtype(fcinfo->flinfo, 2));
+		if (has_hi)
+			check_record_key(variable, get_fn_expr_argtype(fcinfo->flinfo, 3));
+
+		if (record->index == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("variable \"%s\" has no ordered index",
+							GetName(variable)),
+					 errhint("Use pgv_create_ordered_index() to create it.")));
+
+		if (MaterializePreferred(fcinfo))
+		{
+			selectRecordsMaterialized(fcinfo, record,
+									  record_index_begin(record, lo, has_lo,
+														 hi, has_hi, true));
+
+			PG_FREE_IF_COPY(package_name, 0);
+			PG_FREE_IF_COPY(var_name, 1);
+			return (Datum) 0;
+		}
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		funcctx->tuple_desc = record->tupdesc;
+
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+		scan = (RecordScanRec *) palloc0(sizeof(RecordScanRec));
+		scan->iscan = record_index_begin(record, lo, has_lo, hi, has_hi, true);
+		funcctx->user_fctx = scan;
+		MemoryContextSwitchTo(oldcontext);
+
+		addVariableStatEntry(funcctx, variable, scan);
+
+		PG_FREE_IF_COPY(package_name, 0);
+		PG_FREE_IF_COPY(var_name, 1);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+
+	if (recordScanNext(funcctx, &tuple))
+	{
+		Assert(!HeapTupleHeaderHasExternal(
+										   (HeapTupleHeader) DatumGetPointer(tuple)));
+
+		SRF_RETURN_NEXT(funcctx, tuple);
+	}
+	else
+		SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Return records of the variable with the given value of the attribute.
+ * Found records are copied on the first call, so further changes of the
+ * variable don't affect the result.
+ */
+Datum
+variable_select_by(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	Datum	   *tuples;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		text	   *package_name;
+		text	   *var_name;
+		int32		attnum;
+		Datum		value;
+		bool		value_is_null = PG_ARGISNULL(3);
+		Variable   *variable;
+		RecordVar  *record;
+		MemoryContext oldcontext;
+		int			ntuples;
+		int			i;
+
+		CHECK_ARGS_FOR_NULL();
+
+		if (PG_ARGISNULL(2))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("attribute number can not be NULL")));
+
+		/* Get arguments */
+		package_name = PG_GETARG_TEXT_PP(0);
+		var_name = PG_GETARG_TEXT_PP(1);
+		attnum = PG_GETARG_INT32(2);
+		value = value_is_null ? (Datum) 0 : PG_GETARG_DATUM(3);
+
+		variable = getVariable(NULL, package_name, var_name, RECORDOID,
+							   true, true);
+		record = &(GetActualValue(variable).record);
+
+		checkRecordAttnum(variable, attnum);
+		if (!value_is_null)
+			checkRecordAttType(variable, attnum,
+							   get_fn_expr_argtype(fcinfo->flinfo, 3));
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		funcctx->tuple_desc = record->tupdesc;
+
+		if (attnum == 1)
+		{
+			HashRecordSearchKey k;
+			HashRecordEntry *item;
+			bool		found;
+
+			init_record_key(record, value, value_is_null, &k);
+
+			item = (HashRecordEntry *) hash_search(record->rhash, &k,
+												   HASH_FIND, &found);
+			ntuples = found ? 1 : 0;
+			tuples = (Datum *) palloc(sizeof(Datum));
+			if (found)
+				tuples[0] = item->tuple;
+		}
+		else
+		{
+			ntuples = select_record_by(record, attnum - 1, value,
+									   value_is_null, &tuples);
+			if (ntuples < 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						 errmsg("variable \"%s\" has no index by attribute %d",
+								GetName(variable), attnum),
+						 errhint("Use pgv_create_index() to create it.")));
+		}
+
+		for (i = 0; i < ntuples; i++)
+			tuples[i] = datumCopy(tuples[i], false, -1);
+
+		funcctx->max_calls = ntuples;
+		funcctx->user_fctx = tuples;
+
+		MemoryContextSwitchTo(oldcontext);
+		PG_FREE_IF_COPY(package_name, 0);
+		PG_FREE_IF_COPY(var_name, 1);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	tuples = (Datum *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		PERF_COUNT(records_returned, 1);
+		SRF_RETURN_NEXT(funcctx, tuples[funcctx->call_cntr]);
+	}
+	else
+		SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Get the record variable for the functions which scan an attribute of its
+ * records. The first arguments of the functions are the package, the variable
+ * and the attribute number, starting from 1.
+ */
+static Variable *
+getColumnVariable(FunctionCallInfo fcinfo, int32 *attnum)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Variable   *variable;
+
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("attribute number can not be NULL")));
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	*attnum = PG_GETARG_INT32(2);
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
+	checkRecordAttnum(variable, *attnum);
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	return variable;
+}
+
+/*
+ * Return values of the attribute of all records of the variable. Values are
+ * put into the tuplestore at once, so further changes of the variable don't
+ * affect the result.
+ */
+Datum
+variable_select_column(PG_FUNCTION_ARGS)
+{
+	int32		attnum;
+	Variable   *variable;
+	RecordVar  *record;
+	Form_pg_attribute attr;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	Datum	   *values;
+	bool	   *isnull;
+	bool		notnull = false;
+	long		nvalues,
+				i;
+
+	if (!MaterializeAllowed(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	variable = getColumnVariable(fcinfo, &attnum);
+	checkRecordAttType(variable, attnum,
+					   get_fn_expr_argtype(fcinfo->flinfo, 3));
+
+	record = &(GetActualValue(variable).record);
+	attr = GetTupleDescAttr(record->tupdesc, attnum - 1);
+
+#if PG_VERSION_NUM >= 120000
+	tupdesc = CreateTemplateTupleDesc(1);
+#else
+	tupdesc = CreateTemplateTupleDesc(1, false);
+#endif
+	TupleDescInitEntry(tupdesc, (AttrNumber) 1, NameStr(attr->attname),
+					   attr->atttypid, attr->atttypmod, 0);
+	tupstore = beginMaterializedResult(fcinfo, tupdesc);
+
+	nvalues = get_record_column(record, attnum - 1, &values, &isnull);
+	for (i = 0; i < nvalues; i++)
+		tuplestore_putvalues(tupstore, tupdesc, &values[i],
+							 isnull ? &isnull[i] : &notnull);
+
+	return (Datum) 0;
+}
+
+/*
+ * Count not null values of the attribute of records of the variable.
+ */
+Datum
+variable_count(PG_FUNCTION_ARGS)
+{
+	int32		attnum;
+	Variable   *variable;
+	Datum	   *values;
+	bool	   *isnull;
+	long		nvalues,
+				i;
+	int64		count;
+
+	variable = getColumnVariable(fcinfo, &attnum);
+
+	nvalues = get_record_column(&(GetActualValue(variable).record),
+								attnum - 1, &values, &isnull);
+	if (isnull == NULL)
+		count = nvalues;
+	else
+	{
+		count = 0;
+		for (i = 0; i < nvalues; i++)
+			count += !isnull[i];
+	}
+
+	PG_RETURN_INT64(count);
+}
+
+#if PG_VERSION_NUM < 110000
+static inline bool
+pg_add_s64_overflow(int64 a, int64 b, int64 *result)
+{
+	int64		res = (int64) ((uint64) a + (uint64) b);
+
+	if ((a > 0 && b > 0 && res < 0) || (a < 0 && b < 0 && res >= 0))
+		return true;
+	*result = res;
+	return false;
+}
+#endif
+
+/*
+ * Sum integer values. The sum is kept in int64 while it fits, the overflowed
+ * part is moved into numeric.
+ */
+static Datum
+sumIntegers(Oid typid, Datum *values, bool *isnull, long nvalues, bool *found)
+{
+	int64		sum = 0;
+	Datum		overflowed = (Datum) 0;
+	Datum		result;
+	long		i;
+
+	for (i = 0; i < nvalues; i++)
+	{
+		int64		value;
+
+		if (isnull && isnull[i])
+			continue;
+
+		if (typid == INT8OID)
+			value = DatumGetInt64(values[i]);
+		else if (typid == INT4OID)
+			value = DatumGetInt32(values[i]);
+		else
+			value = DatumGetInt16(values[i]);
+
+		if (unlikely(pg_add_s64_overflow(sum, value, &sum)))
+		{
+			Datum		part = DirectFunctionCall1(int8_numeric,
+												   Int64GetDatum(sum));
+
+			overflowed = overflowed ?
+				DirectFunctionCall2(numeric_add, overflowed, part) : part;
+			sum = value;
+		}
+		*found = true;
+	}
+
+	result = DirectFunctionCall1(int8_numeric, Int64GetDatum(sum));
+	if (overflowed)
+		result = DirectFunctionCall2(numeric_add, overflowed, result);
+
+	return result;
+}
+
+/*
+ * Sum numeric values. Intermediate sums are computed in a temporary context,
+ * so that memory doesn't grow with the number of values.
+ */
+static Datum
+sumNumerics(Datum *values, bool *isnull, long nvalues, bool *found)
+{
+	MemoryContext sumctx,
+				oldctx;
+	Datum		sum;
+	Datum		newsum;
+	long		i;
+
+	sumctx = AllocSetContextCreate(CurrentMemoryContext, "pgv_sum",
+								   ALLOCSET_SMALL_SIZES);
+	sum = DirectFunctionCall1(int8_numeric, Int64GetDatum(0));
+
+	for (i = 0; i < nvalues; i++)
+	{
+		if (isnull && isnull[i])
+			continue;
+
+		oldctx = MemoryContextSwitchTo(sumctx);
+		newsum = DirectFunctionCall2(numeric_add, sum, values[i]);
+		MemoryContextSwitchTo(oldctx);
+
+		pfree(DatumGetPointer(sum));
+		sum = datumCopy(newsum, false, -1);
+		MemoryContextReset(sumctx);
+		*found = true;
+	}
+
+	MemoryContextDelete(sumctx);
+
+	return sum;
+}
+
+/*
+ * Sum values of the numeric attribute of records of the variable. The sum is
+ * returned as numeric, NULL if there are no not null values.
+ */
+Datum
+variable_sum(PG_FUNCTION_ARGS)
+{
+	int32		attnum;
+	Variable   *variable;
+	RecordVar  *record;
+	Oid			typid;
+	Datum	   *values;
+	bool	   *isnull;
+	long		nvalues,
+				i;
+	bool		found = false;
+	Datum		result;
+
+	variable = getColumnVariable(fcinfo, &attnum);
+	record = &(GetActualValue(variable).record);
+	typid = GetTupleDescAttr(record->tupdesc, attnum - 1)->atttypid;
+
+	if (typid != INT2OID && typid != INT4OID && typid != INT8OID &&
+		typid != FLOAT4OID && typid != FLOAT8OID && typid != NUMERICOID)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("can not sum values of type %s",
+						format_type_be(typid))));
+
+	nvalues = get_record_column(record, attnum - 1, &values, &isnull);
+
+	switch (typid)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+			result = sumIntegers(typid, values, isnull, nvalues, &found);
+			break;
+		case FLOAT4OID:
+		case FLOAT8OID:
+			{
+				float8		sum = 0;
+
+				for (i = 0; i < nvalues; i++)
+				{
+					if (isnull && isnull[i])
+						continue;
+					sum += typid == FLOAT8OID ? DatumGetFloat8(values[i]) :
+						DatumGetFloat4(values[i]);
+					found = true;
+				}
+				result = DirectFunctionCall1(float8_numeric,
+											 Float8GetDatum(sum));
+				break;
+			}
+		default:
+			result = sumNumerics(values, isnull, nvalues, &found);
+			break;
+	}
+
+	if (!found)
+		PG_RETURN_NULL();
+	PG_RETURN_DATUM(result);
+}
+
+/*
+ * Return the least and the greatest values of the attribute of records of the
+ * variable by the default btree opclass of its type. Values are NULL if there
+ * are no not null values.
+ */
+Datum
+variable_min_max(PG_FUNCTION_ARGS)
+{
+	int32		attnum;
+	Variable   *variable;
+	RecordVar  *record;
+	Form_pg_attribute attr;
+	TypeCacheEntry *typentry;
+	Oid			collation;
+	TupleDesc	tupdesc;
+	Datum	   *values;
+	bool	   *isnull;
+	long		nvalues,
+				i;
+	Datum		result[2];
+	bool		result_isnull[2] = {true, true};
+
+	variable = getColumnVariable(fcinfo, &attnum);
+	checkRecordAttType(variable, attnum,
+					   get_fn_expr_argtype(fcinfo->flinfo, 3));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	record = &(GetActualValue(variable).record);
+	attr = GetTupleDescAttr(record->tupdesc, attnum - 1);
+
+	typentry = lookup_type_cache(attr->atttypid, TYPECACHE_CMP_PROC_FINFO);
+	if (!OidIsValid(typentry->cmp_proc_finfo.fn_oid))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_FUNCTION),
+				 errmsg("could not identify a comparison function for type %s",
+						format_type_be(attr->atttypid))));
+	collation = OidIsValid(attr->attcollation) ? attr->attcollation :
+		PG_GET_COLLATION();
+
+	nvalues = get_record_column(record, attnum - 1, &values, &isnull);
+	for (i = 0; i < nvalues; i++)
+	{
+		if (isnull && isnull[i])
+			continue;
+
+		if (result_isnull[0])
+		{
+			result[0] = result[1] = values[i];
+			result_isnull[0] = result_isnull[1] = false;
+		}
+		else if (DatumGetInt32(FunctionCall2Coll(&typentry->cmp_proc_finfo,
+												 collation, values[i],
+												 result[0])) < 0)
+			result[0] = values[i];
+		else if (DatumGetInt32(FunctionCall2Coll(&typentry->cmp_proc_finfo,
+												 collation, values[i],
+												 result[1])) > 0)
+			result[1] = values[i];
+	}
+
+	tupdesc = BlessTupleDesc(tupdesc);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, result,
+													  result_isnull)));
+}
+
+/*
+ * Open a cursor over records of the variable and return its identifier. The
+ * ordered index of the variable is created if it doesn't exist.
+ */
+Datum
+cursor_open(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Variable   *variable;
+	RecordVar  *record;
+	Form_pg_attribute attr;
+	RecordCursor *cursor;
+	int32		id;
+	bool		found;
+
+	CHECK_ARGS_FOR_NULL();
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
+	record = &(GetActualValue(variable).record);
+	create_record_index(record);
+
+	if (cursorsHash == NULL)
+	{
+		HASHCTL		ctl;
+
+		CursorsContext = AllocSetContextCreate(TopMemoryContext,
+											   "pg_variables cursors",
+											   ALLOCSET_SMALL_SIZES);
+
+		ctl.keysize = sizeof(int32);
+		ctl.entrysize = sizeof(RecordCursor);
+		ctl.hcxt = CursorsContext;
+		cursorsHash = hash_create("Cursors hash", NUMVARIABLES, &ctl,
+								  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	/* Skip identifiers of open cursors after a wraparound */
+	do
+	{
+		if (++lastCursorId <= 0)
+			lastCursorId = 1;
+		id = lastCursorId;
+		cursor = (RecordCursor *) hash_search(cursorsHash, &id, HASH_ENTER,
+											  &found);
+	} while (found);
+
+	attr = GetTupleDescAttr(record->tupdesc, 0);
+	cursor->id = id;
+	strlcpy(cursor->package, GetName(variable->package), NAMEDATALEN);
+	strlcpy(cursor->name, GetName(variable), NAMEDATALEN);
+	cursor->keytype = attr->atttypid;
+	cursor->keybyval = attr->attbyval;
+	cursor->keylen = attr->attlen;
+	cursor->last = (Datum) 0;
+	cursor->last_is_null = false;
+	cursor->has_last = false;
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_INT32(id);
+}
+
+/*
+ * Get the open cursor by its identifier.
+ */
+static RecordCursor *
+getCursor(int32 id)
+{
+	RecordCursor *cursor = NULL;
+
+	if (cursorsHash != NULL)
+		cursor = (RecordCursor *) hash_search(cursorsHash, &id, HASH_FIND,
+											  NULL);
+	if (cursor == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized cursor %d", id)));
+
+	return cursor;
+}
+
+/*
+ * Return up to n next records of the cursor in order of keys. Records
+ * inserted after the position of the cursor are returned by further fetches,
+ * records removed before they are fetched aren't returned.
+ */
+Datum
+cursor_fetch(PG_FUNCTION_ARGS)
+{
+	RecordCursor *cursor;
+	int32		n;
+	text	   *package_name;
+	text	   *var_name;
+	Variable   *variable;
+	RecordVar  *record;
+	RecordIndexScan *scan;
+	Tuplestorestate *tupstore;
+	Datum		tuple;
+	Datum		last;
+	bool		last_is_null;
+	int32		i;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("cursor can not be NULL")));
+	if (PG_ARGISNULL(1))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of records can not be NULL")));
+
+	if (!MaterializeAllowed(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	cursor = getCursor(PG_GETARG_INT32(0));
+	n = PG_GETARG_INT32(1);
+
+	/* The variable may have been removed or created again */
+	package_name = cstring_to_text(cursor->package);
+	var_name = cstring_to_text(cursor->name);
+	variable = getVariable(NULL, package_name, var_name, RECORDOID, true,
+						   true);
+	record = &(GetActualValue(variable).record);
+
+	if (GetTupleDescAttr(record->tupdesc, 0)->atttypid != cursor->keytype)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("key type of variable \"%s\" changed since cursor %d "
+						"was opened", cursor->name, cursor->id)));
+	create_record_index(record);
+
+	tupstore = beginMaterializedResult(fcinfo, record->tupdesc);
+
+	if (cursor->has_last)
+		scan = record_index_begin_after(record, cursor->last,
+										cursor->last_is_null);
+	else
+		scan = record_index_begin(record, (Datum) 0, false, (Datum) 0, false,
+								  false);
+
+	for (i = 0; i < n && record_index_next(scan, &tuple); i++)
+		putRecordTuple(tupstore, tuple);
+
+	/* Move the position of the cursor */
+	if (record_index_last(scan, &last, &last_is_null))
+	{
+		MemoryContext oldcxt;
+
+		if (cursor->has_last && !cursor->last_is_null && !cursor->keybyval)
+			pfree(DatumGetPointer(cursor->last));
+
+		oldcxt = MemoryContextSwitchTo(CursorsContext);
+		cursor->last_is_null = last_is_null;
+		cursor->last = last_is_null ? (Datum) 0 :
+			datumCopy(last, cursor->keybyval, cursor->keylen);
+		cursor->has_last = true;
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * Close the cursor.
+ */
+Datum
+cursor_close(PG_FUNCTION_ARGS)
+{
+	RecordCursor *cursor;
+	int32		id;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("cursor can not be NULL")));
+
+	id = PG_GETARG_INT32(0);
+	cursor = getCursor(id);
+
+	if (cursor->has_last && !cursor->last_is_null && !cursor->keybyval)
+		pfree(DatumGetPointer(cursor->last));
+	hash_search(cursorsHash, &id, HASH_REMOVE, NULL);
+
+	PG_RETURN_VOID();
+}
+
+Datum
+variable_select_by_value(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Oid			value_type;
+	Datum		value;
+	bool		value_is_null = PG_ARGISNULL(2);
+	Variable   *variable;
+
+	HashRecordEntry *item;
+	RecordVar  *record;
+	HashRecordSearchKey k;
+	bool		found;
+
+	CHECK_ARGS_FOR_NULL();
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	if (!value_is_null)
+	{
+		value_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
+		value = PG_GETARG_DATUM(2);
+	}
+	else
+	{
+		value_type = InvalidOid;
+		value = 0;
+	}
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, false);
+
+	/* Search the shared variable if there is no local one */
+	if (variable == NULL || !GetActualState(variable)->is_valid)
+	{
+		Datum		result;
+
+		if (select_shared_record(package_name, var_name, value_type, value,
+								 value_is_null, &result, &found))
+		{
+			PG_FREE_IF_COPY(package_name, 0);
+			PG_FREE_IF_COPY(var_name, 1);
+
+			if (found)
+			{
+				PERF_COUNT(records_returned, 1);
+				PG_RETURN_DATUM(result);
+			}
+			else
+				PG_RETURN_NULL();
+		}
+
+		/* Report the missing variable */
+		variable = getVariable(fcinfo->flinfo, package_name, var_name,
+							   RECORDOID, true, true);
+	}
+
+	if (!value_is_null)
+		check_record_key(variable, value_type);
+
+	record = &(GetActualValue(variable).record);
+
+	/* Search a record */
+	init_record_key(record, value, value_is_null, &k);
+
+	item = (HashRecordEntry *) hash_search(record->rhash, &k,
+										   HASH_FIND, &found);
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	if (found)
+	{
+		Assert(!HeapTupleHeaderHasExternal(
+										   (HeapTupleHeader) DatumGetPointer(item->tuple)));
+
+		PERF_COUNT(records_returned, 1);
+		PG_RETURN_DATUM(item->tuple);
+	}
+	else
+		PG_RETURN_NULL();
+}
+
+/*
+ * Find records by all keys of the array and return them at once in
+ * materialize mode.
+ */
+static void
+selectByValuesMaterialized(FunctionCallInfo fcinfo, Variable *variable,
+						   ArrayType *values)
+{
+	RecordVar  *record = &(GetActualValue(variable).record);
+	Tuplestorestate *tupstore;
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	int16		elmlen;
+	bool		elmbyval;
+	char		elmalign;
+	int			i;
+
+	get_typlenbyvalalign(ARR_ELEMTYPE(values), &elmlen, &elmbyval, &elmalign);
+	deconstruct_array(values, ARR_ELEMTYPE(values), elmlen, elmbyval,
+					  elmalign, &elems, &nulls, &nelems);
+
+	tupstore = beginMaterializedResult(fcinfo, record->tupdesc);
+
+	for (i = 0; i < nelems; i++)
+	{
+		HashRecordSearchKey k;
+		HashRecordEntry *item;
+		bool		found;
+
+		init_record_key(record, elems[i], nulls[i], &k);
+
+		item = (HashRecordEntry *) hash_search(record->rhash, &k,
+											   HASH_FIND, &found);
+		if (found)
+			putRecordTuple(tupstore, item->tuple);
+	}
+
+	pfree(elems);
+	pfree(nulls);
+}
+
+/* Structure for variable_select_by_values() */
+typedef struct
+{
+	Variable   *variable;
+	ArrayIterator iterator;
+}			VariableIteratorRec;
+
+Datum
+variable_select_by_values(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	VariableIteratorRec *var;
+	Datum		value;
+	HashRecordEntry *item;
+	bool		isnull;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		text	   *package_name;
+		text	   *var_name;
+		ArrayType  *values;
+		Variable   *variable;
+		MemoryContext oldcontext;
+
+		/* Checks */
+		CHECK_ARGS_FOR_NULL();
+
+		if (PG_ARGISNULL(2))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("array argument can not be NULL")));
+
+		values = PG_GETARG_ARRAYTYPE_P(2);
+		if (ARR_NDIM(values) > 1)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("searching for elements in multidimensional arrays is not supported")));
+
+		/* Get arguments */
+		package_name = PG_GETARG_TEXT_PP(0);
+		var_name = PG_GETARG_TEXT_PP(1);
+
+		variable = getVariable(NULL, package_name, var_name, RECORDOID,
+							   true, true);
+
+		check_record_key(variable, ARR_ELEMTYPE(values));
+
+		/* Return all found records at once if it is possible */
+		if (MaterializeAllowed(fcinfo))
+		{
+			selectByValuesMaterialized(fcinfo, variable, values);
+
+			PG_FREE_IF_COPY(package_name, 0);
+			PG_FREE_IF_COPY(var_name, 1);
+			return (Datum) 0;
+		}
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		funcctx->tuple_desc = GetActualValue(variable).record.tupdesc;
+
+		var = (VariableIteratorRec *) palloc(sizeof(VariableIteratorRec));
+		var->iterator = array_create_iterator(values, 0, NULL);
+		var->variable = variable;
+		funcctx->user_fctx = var;
+
+		MemoryContextSwitchTo(oldcontext);
+		PG_FREE_IF_COPY(package_name, 0);
+		PG_FREE_IF_COPY(var_name, 1);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	var = (VariableIteratorRec *) funcctx->user_fctx;
+
+	/* Get next array element */
+	while (array_iterate(var->iterator, &value, &isnull))
+	{
+		HashRecordSearchKey k;
+		bool		found;
+		RecordVar  *record;
+
+		record = &(GetActualValue(var->variable).record);
+		/* Search a record */
+		init_record_key(record, value, isnull, &k);
+
+		item = (HashRecordEntry *) hash_search(record->rhash, &k,
+											   HASH_FIND, &found);
+		if (found)
+		{
+			Assert(!HeapTupleHeaderHasExternal(
+											   (HeapTupleHeader) DatumGetPointer(item->tuple)));
+			PERF_COUNT(records_returned, 1);
+			SRF_RETURN_NEXT(funcctx, item->tuple);
+		}
+	}
+
+	array_free_iterator(var->iterator);
+	pfree(var);
+	SRF_RETURN_DONE(funcctx);
+}
+
+/*
+ * Publish records of the variable for other backends of the database.
+ */
+Datum
+variable_share(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Variable   *variable;
+
+	CHECK_ARGS_FOR_NULL();
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
+	share_record(package_name, var_name, &(GetActualValue(variable).record));
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Remove the shared variable.
+ */
+Datum
+variable_unshare(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+
+	CHECK_ARGS_FOR_NULL();
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	if (!unshare_record(package_name, var_name))
+	{
+		char		key[NAMEDATALEN];
+
+		getKeyFromName(var_name, key);
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("unrecognized shared variable \"%s\"", key)));
+	}
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Check if variable exists.
+ */
+Datum
+variable_exists(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Variable   *variable;
+
+	CHECK_ARGS_FOR_NULL();
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name,
+						   InvalidOid, false, false);
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_BOOL(variable ? GetActualState(variable)->is_valid : false);
+}
+
+/*
+ * Check if package exists.
+ */
+Datum
+package_exists(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	bool		res;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("package name can not be NULL")));
+
+	package_name = PG_GETARG_TEXT_PP(0);
+
+	res = getPackage(package_name, false) != NULL;
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_RETURN_BOOL(res);
+}
+
+/*
+ * Remove variable from package by name.
+ */
+Datum
+remove_variable(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Package    *package;
+	Variable   *variable;
+	TransObject *transObject;
+
+	CHECK_ARGS_FOR_NULL();
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	variable = getVariable(fcinfo->flinfo, package_name, var_name,
+						   InvalidOid, false, true);
+	package = variable->package;
+
+	/* Add package to changes list, so we can remove it if it is empty */
+	if (!isObjectChangedInCurrentTrans(&package->transObject))
+	{
+		createSavepoint(&package->transObject, TRANS_PACKAGE);
+		addToChangesStack(&package->transObject, TRANS_PACKAGE);
+	}
+
+	transObject = &variable->transObject;
+	if (variable->is_transactional)
+	{
+		if (!isObjectChangedInCurrentTrans(transObject))
+		{
+			createSavepoint(transObject, TRANS_VARIABLE);
+			addToChangesStack(transObject, TRANS_VARIABLE);
+		}
+		variable->is_deleted = true;
+		GetActualState(variable)->is_valid = false;
+		GetPackState(package)->trans_var_num--;
+		if ((GetPackState(package)->trans_var_num + numOfRegVars(package)) == 0)
+			GetActualState(package)->is_valid = false;
+	}
+	else
+		removeObject(&variable->transObject, TRANS_VARIABLE);
+
+	resetVariablesCache();
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Remove package by name.
+ */
+Datum
+remove_package(PG_FUNCTION_ARGS)
+{
+	Package    *package;
+	text	   *package_name;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("package name can not be NULL")));
+
+	package_name = PG_GETARG_TEXT_PP(0);
+
+	package = getPackage(package_name, true);
+	/*
+	 * Need to remove variables before removing package because
+	 * remove_variables_package() calls hash_seq_term() which uses
+	 * "entry->status->hashp->frozen" but memory context of "hashp"
+	 * for regular variables can be deleted in removePackageInternal().
+	 */
+	remove_variables_package(&variables_stats, package);
+
+	removePackageInternal(package);
+
+	resetVariablesCache();
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_RETURN_VOID();
+}
+
+static void
+removePackageInternal(Package *package)
+{
+	TransObject *transObject;
+	Variable   *variable;
+	HTAB	   *htab;
+	HASH_SEQ_STATUS vstat;
+	int			i;
+
+	/* Mark all the valid variables from package as deleted */
+	for (i = 0; i < 2; i++)
+	{
+		if ((htab = pack_htab(package, i)) != NULL)
+		{
+			hash_seq_init(&vstat, htab);
+
+			while ((variable =
+					(Variable *) hash_seq_search(&vstat)) != NULL)
+			{
+				if (GetActualState(variable)->is_valid)
+					variable->is_deleted = true;
+			}
+		}
+	}
+
+	/* Cached pointers to variables freed below must not be used */
+	resetVariablesCache();
+
+	/* Spilled regular variables aren't needed anymore */
+	if (package->is_spilled)
+		releaseSpilledPackage(package);
+
+	/* All regular variables will be freed */
+	if (package->hctxRegular)
+	{
+		MemoryContextDelete(package->hctxRegular);
+		package->hctxRegular = NULL;
+		package->varHashRegular = NULL;
+	}
+
+	/* Add to changes list */
+	transObject = &package->transObject;
+	if (!isObjectChangedInCurrentTrans(transObject))
+	{
+		createSavepoint(transObject, TRANS_PACKAGE);
+		addToChangesStack(transObject, TRANS_PACKAGE);
+	}
+	GetActualState(package)->is_valid = false;
+	GetPackState(package)->trans_var_num = 0;
+}
+
+/* Check if package has any valid variables */
+static bool
+isPackageEmpty(Package *package)
+{
+	int			var_num = GetPackState(package)->trans_var_num;
+
+	var_num += numOfRegVars(package);
+
+	return var_num == 0;
+}
+
+/*
+ * Reset cache variables to their default values. It is necessary to do in case
+ * of some changes: removing, rollbacking, etc.
+ */
+static void
+resetVariablesCache(void)
+{
+	/* Remove packages and variables from cache */
+	MemSet(VariablesCache, 0, sizeof(VariablesCache));
+	/* Invalidate variables resolved by function calls */
+	VariablesCacheGeneration++;
+}
+
+/*
+ * Remove all packages and variables.
+ * Memory context will be released after committing.
+ */
+Datum
+remove_packages(PG_FUNCTION_ARGS)
+{
+	Package    *package;
+	HASH_SEQ_STATUS pstat;
+
+	/* There is no any packages and variables */
+	if (packagesHash == NULL)
+		PG_RETURN_VOID();
+
+	/*
+	 * Need to remove variables before removing packages because
+	 * remove_variables_all() calls hash_seq_term() which uses
+	 * "entry->status->hashp->frozen" but memory context of "hashp"
+	 * for regular variables can be deleted in removePackageInternal().
+	 */
+	remove_variables_all(&variables_stats);
+
+	/* Get packages list */
+	hash_seq_init(&pstat, packagesHash);
+	while ((package = (Package *) hash_seq_search(&pstat)) != NULL)
+	{
+		removePackageInternal(package);
+	}
+
+	resetVariablesCache();
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Filter of packages by a LIKE pattern of their names, see getFilteredPackages().
+ */
+typedef struct PackageFilter
+{
+	text	   *pattern;		/* NULL if all packages pass the filter */
+	Oid			collid;			/* collation to match the pattern */
+	int			prefix_len;		/* length of the prefix for "prefix%" */
+	bool		exact;			/* the pattern is a name without wildcards */
+}			PackageFilter;
+
+/*
+ * Initialize the filter of packages by the optional argument of pgv_list()
+ * and pgv_stats().
+ */
+static void
+initPackageFilter(FunctionCallInfo fcinfo, PackageFilter *filter)
+{
+	char	   *p;
+	int			len;
+	int			i;
+
+	memset(filter, 0, sizeof(PackageFilter));
+	filter->prefix_len = -1;
+	if (PG_NARGS() == 0)
+		return;
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("pattern can not be NULL")));
+
+	filter->pattern = PG_GETARG_TEXT_PP(0);
+	filter->collid = OidIsValid(PG_GET_COLLATION()) ?
+		PG_GET_COLLATION() : DEFAULT_COLLATION_OID;
+
+	/* Find the first wildcard of the pattern */
+	p = VARDATA_ANY(filter->pattern);
+	len = VARSIZE_ANY_EXHDR(filter->pattern);
+	for (i = 0; i < len; i++)
+		if (p[i] == '%' || p[i] == '_' || p[i] == '\\')
+			break;
+
+	if (i == len)
+		filter->exact = true;
+	else if (i == len - 1 && p[i] == '%')
+		filter->prefix_len = i;
+}
+
+/* Check if the package name matches the pattern of the filter */
+static bool
+matchPackageFilter(PackageFilter *filter, const char *name)
+{
+	text	   *name_text;
+	bool		result;
+
+	if (filter->pattern == NULL)
+		return true;
+	if (filter->exact)
+		return isNameEqual(filter->pattern, name);
+	if (filter->prefix_len >= 0)
+		return strncmp(name, VARDATA_ANY(filter->pattern),
+					   filter->prefix_len) == 0;
+
+	name_text = cstring_to_text(name);
+	result = DatumGetBool(DirectFunctionCall2Coll(textlike, filter->collid,
+												  PointerGetDatum(name_text),
+												  PointerGetDatum(filter->pattern)));
+	pfree(name_text);
+
+	return result;
+}
+
+/*
+ * Get packages which pass the filter, only valid ones if valid_only is true.
+ * The package with the name given by a pattern without wildcards is found
+ * without the scan of all packages.
+ */
+static Package **
+getFilteredPackages(PackageFilter *filter, bool valid_only, int *npackages)
+{
+	Package   **packages;
+	Package    *package;
+	HASH_SEQ_STATUS pstat;
+
+	*npackages = 0;
+	if (packagesHash == NULL)
+		return NULL;
+
+	if (filter->exact)
+	{
+		char		key[NAMEDATALEN];
+		int			len = VARSIZE_ANY_EXHDR(filter->pattern);
+
+		if (len >= NAMEDATALEN)
+			return NULL;
+		memcpy(key, VARDATA_ANY(filter->pattern), len);
+		key[len] = '\0';
+
+		package = (Package *) hash_search(packagesHash, key, HASH_FIND, NULL);
+		if (package == NULL ||
+			(valid_only && !GetActualState(package)->is_valid))
+			return NULL;
+
+		packages = (Package **) palloc(sizeof(Package *));
+		packages[(*npackages)++] = package;
+		return packages;
+	}
+
+	packages = (Package **) palloc(Max(hash_get_num_entries(packagesHash), 1) *
+								   sizeof(Package *));
+	hash_seq_init(&pstat, packagesHash);
+	while ((package = (Package *) hash_seq_search(&pstat)) != NULL)
+	{
+		if ((!valid_only || GetActualState(package)->is_valid) &&
+			matchPackageFilter(filter, GetName(package)))
+			packages[(*npackages)++] = package;
+	}
+
+	return packages;
+}
+
+/*
+ * Get list of assigned packages and variables. The optional argument is a
+ * LIKE pattern of names of packages.
+ */
+Datum
+get_packages_and_variables(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	PackageFilter filter;
+	Package   **packages;
+	int			npackages;
+	int			p;
+
+	if (!MaterializeAllowed(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+
+	initPackageFilter(fcinfo, &filter);
+	tupstore = beginMaterializedResult(fcinfo, tupdesc);
+
+	packages = getFilteredPackages(&filter, true, &npackages);
+	for (p = 0; p < npackages; p++)
+	{
+		Package    *package = packages[p];
+		int			i;
+
+		/* Names of spilled variables are known only from the dump */
+		if (package->is_spilled)
+		{
+			listSpilledVariables(package, tupstore, tupdesc);
+			continue;
+		}
+
+		/* Get variables list for package */
+		for (i = 0; i < 2; i++)
+		{
+			HTAB	   *htab = pack_htab(package, i);
+			HASH_SEQ_STATUS vstat;
+			Variable   *variable;
+
+			if (!htab)
+				continue;
+			hash_seq_init(&vstat, htab);
+			while ((variable = (Variable *) hash_seq_search(&vstat)) != NULL)
+			{
+				Datum		values[3];
+				bool		nulls[3];
+
+				if (!GetActualState(variable)->is_valid)
+					continue;
+
+				memset(nulls, 0, sizeof(nulls));
+				values[0] = PointerGetDatum(cstring_to_text(GetName(package)));
+				values[1] = PointerGetDatum(cstring_to_text(GetName(variable)));
+				values[2] = BoolGetDatum(variable->is_transactional);
+
+				tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			}
+		}
+	}
+
+	if (packages)
+		pfree(packages);
+
+	return (Datum) 0;
+}
+
+#if PG_VERSION_NUM < 130000
+static void
+getMemoryTotalSpace(MemoryContext context, int level, Size *totalspace)
+{
+#if PG_VERSION_NUM >= 90600
+	MemoryContext child;
+	MemoryContextCounters totals;
+
+	Assert(MemoryContextIsValid(context));
+
+	/* Examine the context itself */
+	memset(&totals, 0, sizeof(totals));
+#if PG_VERSION_NUM >= 110000
+	(*context->methods->stats) (context, NULL, NULL, &totals);
+#else
+	(*context->methods->stats) (context, level, false, &totals);
+#endif
+	*totalspace += totals.totalspace;
+
+	/*
+	 * Examine children.
+	 */
+	for (child = context->firstchild; child != NULL; child = child->nextchild)
+		getMemoryTotalSpace(child, level + 1, totalspace);
+#else
+	*totalspace = 0;
+#endif
+}
+#endif
+
+/*
+ * Get memory allocated by the context and its children in bytes. Since 13 the
+ * contexts keep counters of allocated memory, so blocks aren't examined.
+ */
+static Size
+getMemoryAllocated(MemoryContext context)
+{
+#if PG_VERSION_NUM >= 130000
+	return MemoryContextMemAllocated(context, true);
+#else
+	Size		totalspace = 0;
+
+	getMemoryTotalSpace(context, 0, &totalspace);
+	return totalspace;
+#endif
+}
+
+/*
+ * Check that size bytes more can be stored without exceeding
+ * pg_variables.max_memory. Memory allocated by the module is counted only if
+ * its estimate plus size exceeds the limit, otherwise the estimate is just
+ * increased by size.
+ */
+void
+check_memory_limit(Size size)
+{
+	Size		limit;
+
+	if (max_memory == 0 || ModuleContext == NULL)
+		return;
+
+	limit = (Size) max_memory * 1024;
+	if (allocatedMemory + size > limit)
+	{
+		allocatedMemory = getMemoryAllocated(ModuleContext);
+		if (allocatedMemory + size > limit)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("memory limit of variables is exceeded"),
+					 errdetail("Failed on request of size %zu.", size),
+					 errhint("Remove some variables or increase \"pg_variables.max_memory\".")));
+	}
+	allocatedMemory += size;
+}
+
+/*
+ * Decrease the estimate of memory allocated by the module by size bytes of
+ * freed values counted by check_memory_limit(), so that memory is counted
+ * exactly only when the limit is really approached. Memory of removed
+ * variables and packages isn't subtracted, it is found by the next count.
+ */
+void
+release_memory(Size size)
+{
+	allocatedMemory -= Min(allocatedMemory, size);
+}
+
+/*
+ * Compress a varlena value to store it, if it is wider than
+ * pg_variables.compression_threshold. The compression method of the server
+ * for new TOAST values is used. Returns the compressed copy in the current
+ * memory context, or 0 if the value should be stored as is.
+ */
+Datum
+compress_value(Datum value)
+{
+	struct varlena *v = (struct varlena *) DatumGetPointer(value);
+
+	if (compression_threshold == 0 || VARATT_IS_EXTENDED(v) ||
+		VARSIZE(v) <= compression_threshold)
+		return (Datum) 0;
+
+#if PG_VERSION_NUM >= 140000
+	return toast_compress_datum(value, default_toast_compression);
+#else
+	return toast_compress_datum(value);
+#endif
+}
+
+/*
+ * Count valid variables of the hash and records of its valid record variables.
+ */
+static void
+countVariables(HTAB *varHash, int64 *nvariables, int64 *nrecords)
+{
+	HASH_SEQ_STATUS vstat;
+	Variable   *variable;
+
+	if (varHash == NULL)
+		return;
+
+	hash_seq_init(&vstat, varHash);
+	while ((variable = (Variable *) hash_seq_search(&vstat)) != NULL)
+	{
+		if (!GetActualState(variable)->is_valid)
+			continue;
+
+		(*nvariables)++;
+		if (variable->is_record)
+			*nrecords += hash_get_num_entries(GetActualValue(variable).record.rhash);
+	}
+}
+
+/*
+ * Fill the values of the row of pgv_stats() for the package. Invalid package
+ * has no valid variables.
+ */
+static void
+fillPackageStats(Package *package, Datum *values, bool *nulls)
+{
+	Size		regularSpace = 0,
+				transactSpace = 0;
+	int64		nvariables = 0,
+				nrecords = 0;
+
+	memset(nulls, 0, sizeof(bool) * 6);
+
+	values[0] = PointerGetDatum(cstring_to_text(GetName(package)));
+
+	if (package->hctxRegular)
+		regularSpace = getMemoryAllocated(package->hctxRegular);
+	if (package->hctxTransact)
+		transactSpace = getMemoryAllocated(package->hctxTransact);
+
+	values[1] = Int64GetDatum(regularSpace + transactSpace);
+	values[2] = Int64GetDatum(regularSpace);
+	values[3] = Int64GetDatum(transactSpace);
+
+	if (GetActualState(package)->is_valid && package->is_spilled)
+	{
+		nvariables = package->spill_nvariables;
+		nrecords = package->spill_nrecords;
+	}
+	else if (GetActualState(package)->is_valid)
+	{
+		countVariables(package->varHashRegular, &nvariables, &nrecords);
+		countVariables(package->varHashTransact, &nvariables, &nrecords);
+	}
+	values[4] = Int64GetDatum(nvariables);
+	values[5] = Int64GetDatum(nrecords);
+}
+
+/*
+ * Get list of packages which pass the filter, used memory in bytes and
+ * numbers of variables and records, see get_packages_stats().
+ */
+static void
+getFilteredPackagesStats(FunctionCallInfo fcinfo)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	PackageFilter filter;
+	Package   **packages;
+	int			npackages;
+	int			p;
+
+	if (!MaterializeAllowed(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	/* Build a tuple descriptor for our result type */
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+
+	initPackageFilter(fcinfo, &filter);
+	tupstore = beginMaterializedResult(fcinfo, tupdesc);
+
+	packages = getFilteredPackages(&filter, false, &npackages);
+	for (p = 0; p < npackages; p++)
+	{
+		Datum		values[6];
+		bool		nulls[6];
+
+		fillPackageStats(packages[p], values, nulls);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	if (packages)
+		pfree(packages);
+}
+
+/*
+ * Get list of assigned packages, used memory in bytes and numbers of variables
+ * and records. The optional argument is a LIKE pattern of names of packages,
+ * the result is materialized then. Otherwise all packages are scanned one by
+ * one, the scan is stopped by 'ROLLBACK TO SAVEPOINT ...'.
+ */
+Datum
+get_packages_stats(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	MemoryContext oldcontext;
+	PackageStatEntry *entry;
+	Package    *package;
+
+	if (PG_NARGS() > 0)
+	{
+		getFilteredPackagesStats(fcinfo);
+		return (Datum) 0;
+	}
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		TupleDesc	tupdesc;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		/* Build a tuple descriptor for our result type */
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("function returning record called in context "
+							"that cannot accept type record")));
+
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		/*
+		 * Get all packages and variables names and save them into
+		 * funcctx->user_fctx.
+		 */
+		if (packagesHash)
+		{
+			MemoryContext ctx;
+
+			ctx = MemoryContextSwitchTo(TopTransactionContext);
+			entry = palloc0(sizeof(PackageStatEntry));
+			entry->status = (HASH_SEQ_STATUS *) palloc0(sizeof(HASH_SEQ_STATUS));
+			/* Get packages list */
+			hash_seq_init(entry->status, packagesHash);
+
+			entry->levels.level = GetCurrentTransactionNestLevel();
+#ifdef PGPRO_EE
+			entry->levels.atxlevel = getNestLevelATX();
+#endif
+			entry->user_fctx = &funcctx->user_fctx;
+			dlist_push_head(&packages_stats, &entry->node);
+			funcctx->user_fctx = entry;
+			MemoryContextSwitchTo(ctx);
+		}
+		else
+			funcctx->user_fctx = NULL;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
 
+	funcctx = SRF_PERCALL_SETUP();
 	if (funcctx->user_fctx == NULL)
-	{
-		/*
-		 * VariableStatEntry was removed. For example, after call
-		 * 'ROLLBACK TO SAVEPOINT ...'
-		 */
 		SRF_RETURN_DONE(funcctx);
-	}
 
-	/* Get next hash record */
-	rstat = (HASH_SEQ_STATUS *) funcctx->user_fctx;
-	item = (HashRecordEntry *) hash_seq_search(rstat);
-	if (item != NULL)
+	/* Get packages list */
+	entry = (PackageStatEntry *) funcctx->user_fctx;
+
+	package = (Package *) hash_seq_search(entry->status);
+	if (package != NULL)
 	{
-		Assert(!HeapTupleHeaderHasExternal(
-										   (HeapTupleHeader) DatumGetPointer(item->tuple)));
+		Datum		values[6];
+		bool		nulls[6];
+		HeapTuple	tuple;
+		Datum		result;
 
-		SRF_RETURN_NEXT(funcctx, item->tuple);
+		fillPackageStats(package, values, nulls);
+
+		/*
+		 * The function of older versions of the extension returns only the
+		 * first two columns, the rest are not formed.
+		 */
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		result = HeapTupleGetDatum(tuple);
+
+		SRF_RETURN_NEXT(funcctx, result);
 	}
 	else
 	{
-		remove_variables_status(&variables_stats, rstat);
+		removePackageStatEntry(entry);
 		SRF_RETURN_DONE(funcctx);
 	}
 }
 
+/* Names of counters of PerfStats returned by pgv_perf_stats() */
+static const struct
+{
+	const char *name;
+	Size		offset;
+}			perfCounters[] =
+{
+	{"variable_lookups", offsetof(PerfStats, variable_lookups)},
+	{"lookup_cache_hits", offsetof(PerfStats, lookup_cache_hits)},
+	{"scalar_gets", offsetof(PerfStats, scalar_gets)},
+	{"scalar_sets", offsetof(PerfStats, scalar_sets)},
+	{"record_inserts", offsetof(PerfStats, record_inserts)},
+	{"record_updates", offsetof(PerfStats, record_updates)},
+	{"record_deletes", offsetof(PerfStats, record_deletes)},
+	{"records_returned", offsetof(PerfStats, records_returned)},
+	{"bytes_copied", offsetof(PerfStats, bytes_copied)},
+	{"savepoint_copies", offsetof(PerfStats, savepoint_copies)},
+	{"records_saved", offsetof(PerfStats, records_saved)},
+	{"rehashes", offsetof(PerfStats, rehashes)}
+};
+
+/*
+ * Get counters of work done by the session since the last reset. Counters
+ * grow only while pg_variables.track_perf_stats is on.
+ */
+Datum
+get_perf_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	int			i;
+
+	if (!MaterializeAllowed(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	tupstore = beginMaterializedResult(fcinfo, tupdesc);
+
+	for (i = 0; i < lengthof(perfCounters); i++)
+	{
+		Datum		values[2];
+		bool		nulls[2] = {false, false};
+
+		values[0] = PointerGetDatum(cstring_to_text(perfCounters[i].name));
+		values[1] = Int64GetDatum(*(int64 *) ((char *) &perf_stats +
+											  perfCounters[i].offset));
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * Reset counters of pgv_perf_stats().
+ */
 Datum
-variable_select_by_value(PG_FUNCTION_ARGS)
+reset_perf_stats(PG_FUNCTION_ARGS)
+{
+	memset(&perf_stats, 0, sizeof(perf_stats));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Get the number of records of the record variable and the number of records
+ * whose keys have the same hash value as keys of other records.
+ */
+Datum
+variable_hash_stats(PG_FUNCTION_ARGS)
 {
 	text	   *package_name;
 	text	   *var_name;
-	Oid			value_type;
-	Datum		value;
-	bool		value_is_null = PG_ARGISNULL(2);
-	Package    *package;
 	Variable   *variable;
-
-	HashRecordEntry *item;
 	RecordVar  *record;
-	HashRecordKey k;
-	bool		found;
+	TupleDesc	tupdesc;
+	Datum		values[2];
+	bool		nulls[2] = {false, false};
 
 	CHECK_ARGS_FOR_NULL();
 
-	/* Get arguments */
 	package_name = PG_GETARG_TEXT_PP(0);
 	var_name = PG_GETARG_TEXT_PP(1);
 
-	if (!value_is_null)
-	{
-		value_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
-		value = PG_GETARG_DATUM(2);
-	}
-	else
-	{
-		value_type = InvalidOid;
-		value = 0;
-	}
-
-	package = getPackage(package_name, true);
-	variable = getVariableInternal(package, var_name, RECORDOID, true, true);
-
-	if (!value_is_null)
-		check_record_key(variable, value_type);
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
 
+	variable = getVariable(fcinfo->flinfo, package_name, var_name, RECORDOID,
+						   true, true);
 	record = &(GetActualValue(variable).record);
 
-	/* Search a record */
-	k.value = value;
-	k.is_null = value_is_null;
-	k.hash_proc = &record->hash_proc;
-	k.cmp_proc = &record->cmp_proc;
-
-	item = (HashRecordEntry *) hash_search(record->rhash, &k,
-										   HASH_FIND, &found);
+	values[0] = Int64GetDatum(hash_get_num_entries(record->rhash));
+	values[1] = Int64GetDatum(count_record_hash_collisions(record));
 
 	PG_FREE_IF_COPY(package_name, 0);
 	PG_FREE_IF_COPY(var_name, 1);
 
-	if (found)
-	{
-		Assert(!HeapTupleHeaderHasExternal(
-										   (HeapTupleHeader) DatumGetPointer(item->tuple)));
-
-		PG_RETURN_DATUM(item->tuple);
-	}
-	else
-		PG_RETURN_NULL();
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc),
+													  values, nulls)));
 }
 
-/* Structure for variable_select_by_values() */
-typedef struct
-{
-	Variable   *variable;
-	ArrayIterator iterator;
-}			VariableIteratorRec;
+/*
+ * Dump of a package is a stream of its valid variables. Values of scalar
+ * variables are written as datums, record variables are written as their
+ * structure, stored tuple images and attribute numbers of indexes, see
+ * dump_record(). The dump is valid for the database it is made in.
+ */
+#define PGV_DUMP_MAGIC		0x50475644	/* "PGVD" */
+#define PGV_DUMP_VERSION	1
 
-Datum
-variable_select_by_values(PG_FUNCTION_ARGS)
+/*
+ * Write the name into the dump.
+ */
+void
+dump_name(StringInfo buf, const char *name)
 {
-	FuncCallContext *funcctx;
-	VariableIteratorRec *var;
-	Datum		value;
-	HashRecordEntry *item;
-	bool		isnull;
-
-	if (SRF_IS_FIRSTCALL())
-	{
-		text	   *package_name;
-		text	   *var_name;
-		ArrayType  *values;
-		Package    *package;
-		Variable   *variable;
-		MemoryContext oldcontext;
+	int			len = strlen(name);
 
-		/* Checks */
-		CHECK_ARGS_FOR_NULL();
+	pq_sendint32(buf, len);
+	pq_sendbytes(buf, name, len);
+}
 
-		if (PG_ARGISNULL(2))
-			ereport(ERROR,
-					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-					 errmsg("array argument can not be NULL")));
+/*
+ * Read the name from the dump into the buffer of NAMEDATALEN bytes.
+ */
+void
+load_name(StringInfo buf, char *name)
+{
+	int			len = pq_getmsgint(buf, 4);
 
-		values = PG_GETARG_ARRAYTYPE_P(2);
-		if (ARR_NDIM(values) > 1)
-			ereport(ERROR,
-					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-					 errmsg("searching for elements in multidimensional arrays is not supported")));
+	if (len < 0 || len >= NAMEDATALEN)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid dump of package"),
+				 errdetail("Invalid length of name %d.", len)));
 
-		/* Get arguments */
-		package_name = PG_GETARG_TEXT_PP(0);
-		var_name = PG_GETARG_TEXT_PP(1);
+	memcpy(name, pq_getmsgbytes(buf, len), len);
+	name[len] = '\0';
+}
 
-		package = getPackage(package_name, true);
-		variable = getVariableInternal(package, var_name, RECORDOID, true,
-									   true);
+static void
+dumpScalar(ScalarVar *scalar, StringInfo buf)
+{
+	Datum		value = scalar->value;
+	Size		size;
 
-		check_record_key(variable, ARR_ELEMTYPE(values));
+	pq_sendbyte(buf, scalar->is_null);
+	if (scalar->is_null)
+		return;
 
-		funcctx = SRF_FIRSTCALL_INIT();
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+	if (scalar->typbyval)
+	{
+		pq_sendint64(buf, (int64) value);
+		return;
+	}
 
-		funcctx->tuple_desc = GetActualValue(variable).record.tupdesc;
+	/* The value may refer to a toasted value of a table */
+	if (scalar->typlen == -1 && VARATT_IS_EXTERNAL(DatumGetPointer(value)))
+#if PG_VERSION_NUM >= 130000
+		value = PointerGetDatum(detoast_external_attr((struct varlena *) DatumGetPointer(value)));
+#else
+		value = PointerGetDatum(heap_tuple_fetch_attr((struct varlena *) DatumGetPointer(value)));
+#endif
 
-		var = (VariableIteratorRec *) palloc(sizeof(VariableIteratorRec));
-		var->iterator = array_create_iterator(values, 0, NULL);
-		var->variable = variable;
-		funcctx->user_fctx = var;
+	size = datumGetSize(value, false, scalar->typlen);
+	pq_sendint32(buf, size);
+	pq_sendbytes(buf, DatumGetPointer(value), size);
+}
 
-		MemoryContextSwitchTo(oldcontext);
-		PG_FREE_IF_COPY(package_name, 0);
-		PG_FREE_IF_COPY(var_name, 1);
-	}
+/*
+ * Write valid variables of the hash into the dump.
+ */
+static void
+dumpVariables(HTAB *varHash, StringInfo buf)
+{
+	HASH_SEQ_STATUS vstat;
+	Variable   *variable;
 
-	funcctx = SRF_PERCALL_SETUP();
-	var = (VariableIteratorRec *) funcctx->user_fctx;
+	if (varHash == NULL)
+		return;
 
-	/* Get next array element */
-	while (array_iterate(var->iterator, &value, &isnull))
+	hash_seq_init(&vstat, varHash);
+	while ((variable = (Variable *) hash_seq_search(&vstat)) != NULL)
 	{
-		HashRecordKey k;
-		bool		found;
-		RecordVar  *record;
+		if (!GetActualState(variable)->is_valid)
+			continue;
 
-		record = &(GetActualValue(var->variable).record);
-		/* Search a record */
-		k.value = value;
-		k.is_null = isnull;
-		k.hash_proc = &record->hash_proc;
-		k.cmp_proc = &record->cmp_proc;
-
-		item = (HashRecordEntry *) hash_search(record->rhash, &k,
-											   HASH_FIND, &found);
-		if (found)
+		/* The type of the value is known only within the session */
+		if (!variable->is_record && variable->typid == RECORDOID)
 		{
-			Assert(!HeapTupleHeaderHasExternal(
-											   (HeapTupleHeader) DatumGetPointer(item->tuple)));
-			SRF_RETURN_NEXT(funcctx, item->tuple);
+			hash_seq_term(&vstat);
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("variable \"%s\" of type record can not be dumped",
+							GetName(variable))));
 		}
-	}
 
-	array_free_iterator(var->iterator);
-	pfree(var);
-	SRF_RETURN_DONE(funcctx);
+		dump_name(buf, GetName(variable));
+		pq_sendint32(buf, variable->typid);
+		pq_sendbyte(buf, variable->is_record);
+		pq_sendbyte(buf, variable->is_transactional);
+
+		if (variable->is_record)
+			dump_record(&(GetActualValue(variable).record), buf);
+		else
+			dumpScalar(&(GetActualValue(variable).scalar), buf);
+	}
 }
 
 /*
- * Check if variable exists.
+ * Dump all variables of the package into bytea.
  */
 Datum
-variable_exists(PG_FUNCTION_ARGS)
+package_dump(PG_FUNCTION_ARGS)
 {
 	text	   *package_name;
-	text	   *var_name;
 	Package    *package;
-	Variable   *variable = NULL;
-	char		key[NAMEDATALEN];
-	bool		found = false;
+	StringInfoData buf;
+	int64		nvariables = 0,
+				nrecords = 0;
 
-	CHECK_ARGS_FOR_NULL();
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("package name can not be NULL")));
 
 	package_name = PG_GETARG_TEXT_PP(0);
-	var_name = PG_GETARG_TEXT_PP(1);
-
-	package = getPackage(package_name, false);
-	if (package == NULL)
-	{
-		PG_FREE_IF_COPY(package_name, 0);
-		PG_FREE_IF_COPY(var_name, 1);
+	package = getPackage(package_name, true);
 
-		PG_RETURN_BOOL(false);
-	}
+	countVariables(package->varHashRegular, &nvariables, &nrecords);
+	countVariables(package->varHashTransact, &nvariables, &nrecords);
 
-	getKeyFromName(var_name, key);
+	pq_begintypsend(&buf);
+	pq_sendint32(&buf, PGV_DUMP_MAGIC);
+	pq_sendint32(&buf, PGV_DUMP_VERSION);
+	dump_name(&buf, GetName(package));
+	pq_sendint32(&buf, (int32) nvariables);
 
-	if (package->varHashRegular)
-		variable = (Variable *) hash_search(package->varHashRegular,
-											key, HASH_FIND, &found);
-	if (!found && package->varHashTransact)
-		variable = (Variable *) hash_search(package->varHashTransact,
-											key, HASH_FIND, &found);
+	dumpVariables(package->varHashRegular, &buf);
+	dumpVariables(package->varHashTransact, &buf);
 
 	PG_FREE_IF_COPY(package_name, 0);
-	PG_FREE_IF_COPY(var_name, 1);
 
-	PG_RETURN_BOOL(variable ? GetActualState(variable)->is_valid : false);
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
 /*
- * Check if package exists.
+ * Read the value of the scalar variable of the type from the dump and store
+ * it if build is true.
  */
-Datum
-package_exists(PG_FUNCTION_ARGS)
+static void
+loadScalar(Variable *variable, Oid typid, const char *name, StringInfo buf,
+		   bool build)
 {
-	text	   *package_name;
-	bool		res;
+	bool		is_null = pq_getmsgbyte(buf) != 0;
+	int16		typlen;
+	bool		typbyval;
+	Datum		value = (Datum) 0;
 
-	if (PG_ARGISNULL(0))
+	get_typlenbyval(typid, &typlen, &typbyval);
+
+	if (!is_null && typbyval)
+		value = (Datum) pq_getmsgint64(buf);
+	else if (!is_null)
+	{
+		uint32		size = pq_getmsgint(buf, 4);
+		const char *image = pq_getmsgbytes(buf, size);
+		char	   *data;
+
+		/* Make an aligned copy of the value to check it */
+		data = palloc(size);
+		memcpy(data, image, size);
+
+		if ((typlen > 0 && size != typlen) ||
+			(typlen == -1 &&
+			 (size < VARHDRSZ_SHORT ||
+			  (!VARATT_IS_1B(data) && size < VARHDRSZ) ||
+			  VARATT_IS_EXTERNAL(data) || VARSIZE_ANY(data) != size)) ||
+			(typlen == -2 && (size == 0 || strnlen(data, size) != size - 1)))
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid dump of package"),
+					 errdetail("Invalid value of variable \"%s\".", name)));
+
+		value = PointerGetDatum(data);
+	}
+
+	if (build)
+		storeScalarValue(&(GetActualValue(variable).scalar), value, is_null,
+						 pack_hctx(variable->package,
+								   variable->is_transactional));
+
+	if (!is_null && !typbyval)
+		pfree(DatumGetPointer(value));
+}
+
+/*
+ * Read the variable from the dump. If build is false, the dump is only
+ * checked, otherwise the variable is created in the package.
+ */
+static void
+loadVariable(text *package_name, StringInfo buf, bool build)
+{
+	char		name[NAMEDATALEN];
+	Oid			typid;
+	bool		is_record,
+				is_transactional;
+	Variable   *variable = NULL;
+
+	load_name(buf, name);
+	typid = pq_getmsgint(buf, 4);
+	is_record = pq_getmsgbyte(buf) != 0;
+	is_transactional = pq_getmsgbyte(buf) != 0;
+
+	if (!SearchSysCacheExists1(TYPEOID, ObjectIdGetDatum(typid)) ||
+		(is_record && typid != RECORDOID))
 		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("package name can not be NULL")));
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid dump of package"),
+				 errdetail("Invalid type %u of variable \"%s\".",
+						   typid, name)));
 
-	package_name = PG_GETARG_TEXT_PP(0);
+	if (build)
+	{
+		Package    *package;
+		text	   *var_name = cstring_to_text(name);
 
-	res = getPackage(package_name, false) != NULL;
+		package = createPackage(package_name, is_transactional);
+		variable = createVariableInternal(package, var_name, typid,
+										  is_record, is_transactional);
+		pfree(var_name);
+	}
 
-	PG_FREE_IF_COPY(package_name, 0);
-	PG_RETURN_BOOL(res);
+	if (is_record)
+		load_record(variable, buf, build);
+	else
+		loadScalar(variable, typid, name, buf, build);
 }
 
 /*
- * Remove variable from package by name.
+ * Load the package from the dump made by pgv_dump(). The package shouldn't
+ * exist. The whole dump is checked before variables are created.
  */
 Datum
-remove_variable(PG_FUNCTION_ARGS)
+package_load(PG_FUNCTION_ARGS)
 {
-	text	   *package_name;
-	text	   *var_name;
-	Package    *package;
-	Variable   *variable;
-	TransObject *transObject;
+	bytea	   *dump;
+	StringInfoData buf;
+	char		key[NAMEDATALEN];
+	text	   *package_name = NULL;
+	int			pass;
 
-	CHECK_ARGS_FOR_NULL();
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("dump can not be NULL")));
 
-	package_name = PG_GETARG_TEXT_PP(0);
-	var_name = PG_GETARG_TEXT_PP(1);
+	dump = PG_GETARG_BYTEA_PP(0);
 
-	package = getPackage(package_name, true);
-	variable = getVariableInternal(package, var_name, InvalidOid, false, true);
+	buf.data = VARDATA_ANY(dump);
+	buf.len = VARSIZE_ANY_EXHDR(dump);
+	buf.maxlen = buf.len;
 
-	/* Add package to changes list, so we can remove it if it is empty */
-	if (!isObjectChangedInCurrentTrans(&package->transObject))
+	for (pass = 0; pass < 2; pass++)
 	{
-		createSavepoint(&package->transObject, TRANS_PACKAGE);
-		addToChangesStack(&package->transObject, TRANS_PACKAGE);
-	}
+		bool		build = (pass == 1);
+		int			nvariables;
+		int			i;
 
-	transObject = &variable->transObject;
-	if (variable->is_transactional)
-	{
-		if (!isObjectChangedInCurrentTrans(transObject))
+		buf.cursor = 0;
+		if (pq_getmsgint(&buf, 4) != PGV_DUMP_MAGIC ||
+			pq_getmsgint(&buf, 4) != PGV_DUMP_VERSION)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid dump of package"),
+					 errdetail("Unrecognized format of the dump.")));
+
+		load_name(&buf, key);
+		if (!build)
 		{
-			createSavepoint(transObject, TRANS_VARIABLE);
-			addToChangesStack(transObject, TRANS_VARIABLE);
+			package_name = cstring_to_text(key);
+			if (getPackage(package_name, false) != NULL)
+				ereport(ERROR,
+						(errcode(ERRCODE_DUPLICATE_OBJECT),
+						 errmsg("package \"%s\" already exists", key),
+						 errhint("Remove the package before loading it.")));
 		}
-		variable->is_deleted = true;
-		GetActualState(variable)->is_valid = false;
-		GetPackState(package)->trans_var_num--;
-		if ((GetPackState(package)->trans_var_num + numOfRegVars(package)) == 0)
-			GetActualState(package)->is_valid = false;
-	}
-	else
-		removeObject(&variable->transObject, TRANS_VARIABLE);
 
-	resetVariablesCache();
+		nvariables = pq_getmsgint(&buf, 4);
+		for (i = 0; i < nvariables; i++)
+			loadVariable(package_name, &buf, build);
 
-	PG_FREE_IF_COPY(package_name, 0);
-	PG_FREE_IF_COPY(var_name, 1);
+		pq_getmsgend(&buf);
+	}
+
+	pfree(package_name);
+	PG_FREE_IF_COPY(dump, 0);
 
 	PG_RETURN_VOID();
 }
 
 /*
- * Remove package by name.
+ * Free all regular variables of the package.
  */
-Datum
-remove_package(PG_FUNCTION_ARGS)
+static void
+freeRegularVariables(Package *package)
 {
-	Package    *package;
-	text	   *package_name;
-
-	if (PG_ARGISNULL(0))
-		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("package name can not be NULL")));
-
-	package_name = PG_GETARG_TEXT_PP(0);
-
-	package = getPackage(package_name, true);
-	/*
-	 * Need to remove variables before removing package because
-	 * remove_variables_package() calls hash_seq_term() which uses
-	 * "entry->status->hashp->frozen" but memory context of "hashp"
-	 * for regular variables can be deleted in removePackageInternal().
-	 */
-	remove_variables_package(&variables_stats, package);
+	HASH_SEQ_STATUS vstat;
+	Variable   *variable;
 
-	removePackageInternal(package);
+	if (package->varHashRegular == NULL)
+		return;
 
-	resetVariablesCache();
+	hash_seq_init(&vstat, package->varHashRegular);
+	while ((variable = (Variable *) hash_seq_search(&vstat)) != NULL)
+	{
+		while (!dlist_is_empty(&variable->transObject.states))
+			removeState(&variable->transObject, TRANS_VARIABLE,
+						GetActualState(variable));
+	}
 
-	PG_FREE_IF_COPY(package_name, 0);
-	PG_RETURN_VOID();
+	MemoryContextDelete(package->hctxRegular);
+	package->hctxRegular = NULL;
+	package->varHashRegular = NULL;
 }
 
-static void
-removePackageInternal(Package *package)
+/*
+ * Check if regular variables of the package can be spilled. The package
+ * shouldn't have transactional variables and states made by savepoints, and
+ * all its variables should be dumpable by pgv_dump().
+ */
+static bool
+isPackageSpillable(Package *package)
 {
-	TransObject *transObject;
-	Variable   *variable;
-	HTAB	   *htab;
+	TransState *state = GetActualState(package);
 	HASH_SEQ_STATUS vstat;
-	int			i;
+	Variable   *variable;
 
-	/* Mark all the valid variables from package as deleted */
-	for (i = 0; i < 2; i++)
+	if (!state->is_valid || package->is_spilled ||
+		package->varHashTransact != NULL ||
+		package->varHashRegular == NULL ||
+		hash_get_num_entries(package->varHashRegular) == 0 ||
+		dlist_has_next(&package->transObject.states, &state->node))
+		return false;
+#ifdef PGPRO_EE
+	if (package->context != NULL)
+		return false;
+#endif
+
+	/* The dump of the package can't be larger than MaxAllocSize */
+	if (getMemoryAllocated(package->hctxRegular) > MaxAllocSize / 2)
+		return false;
+
+	hash_seq_init(&vstat, package->varHashRegular);
+	while ((variable = (Variable *) hash_seq_search(&vstat)) != NULL)
 	{
-		if ((htab = pack_htab(package, i)) != NULL)
+		if (!variable->is_record && variable->typid == RECORDOID)
 		{
-			hash_seq_init(&vstat, htab);
-
-			while ((variable =
-					(Variable *) hash_seq_search(&vstat)) != NULL)
-			{
-				if (GetActualState(variable)->is_valid)
-					variable->is_deleted = true;
-			}
+			hash_seq_term(&vstat);
+			return false;
 		}
 	}
 
-	/* All regular variables will be freed */
-	if (package->hctxRegular)
-	{
-		MemoryContextDelete(package->hctxRegular);
-		package->hctxRegular = NULL;
-		package->varHashRegular = NULL;
-	}
+	return true;
+}
 
-	/* Add to changes list */
-	transObject = &package->transObject;
-	if (!isObjectChangedInCurrentTrans(transObject))
-	{
-		createSavepoint(transObject, TRANS_PACKAGE);
-		addToChangesStack(transObject, TRANS_PACKAGE);
-	}
-	GetActualState(package)->is_valid = false;
-	GetPackState(package)->trans_var_num = 0;
+/*
+ * Write the dump to the spill file at the given position.
+ */
+static void
+writeSpillDump(BufFile *file, int fileno, off_t offset, char *data, int len)
+{
+	if (BufFileSeek(file, fileno, offset, SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not seek in spill file of packages: %m")));
+#if PG_VERSION_NUM >= 130000
+	BufFileWrite(file, data, len);
+#else
+	if (BufFileWrite(file, data, len) != len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to spill file of packages: %m")));
+#endif
 }
 
-/* Check if package has any valid variables */
-static bool
-isPackageEmpty(Package *package)
+/*
+ * Read the dump of the spilled package into buf, which is palloc'd.
+ */
+static void
+readSpillDump(Package *package, StringInfo buf)
 {
-	int			var_num = GetPackState(package)->trans_var_num;
+	Assert(package->is_spilled);
 
-	if (package->varHashRegular)
-		var_num += hash_get_num_entries(package->varHashRegular);
+	buf->data = palloc(package->spill_size);
+	buf->len = package->spill_size;
+	buf->maxlen = buf->len;
+	buf->cursor = 0;
 
-	return var_num == 0;
+	if (BufFileSeek(spillFile, package->spill_fileno, package->spill_offset,
+					SEEK_SET) != 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not seek in spill file of packages: %m")));
+#if PG_VERSION_NUM >= 160000
+	BufFileReadExact(spillFile, buf->data, buf->len);
+#else
+	if (BufFileRead(spillFile, buf->data, buf->len) != buf->len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read from spill file of packages: %m")));
+#endif
 }
 
 /*
- * Reset cache variables to their default values. It is necessary to do in case
- * of some changes: removing, rollbacking, etc.
+ * Write regular variables of the package to the end of the spill file in the
+ * format of pgv_dump() and free them.
  */
 static void
-resetVariablesCache(void)
+spillPackage(Package *package)
 {
-	/* Remove package and variable from cache */
-	LastPackage = NULL;
-	LastVariable = NULL;
+	StringInfoData buf;
+	int64		nvariables = 0,
+				nrecords = 0;
+
+	countVariables(package->varHashRegular, &nvariables, &nrecords);
+
+	initStringInfo(&buf);
+	dumpVariables(package->varHashRegular, &buf);
+
+	if (spillFile == NULL)
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+
+		spillFile = BufFileCreateTemp(true);
+		spillFileEndno = 0;
+		spillFileEnd = 0;
+		spillFileSize = 0;
+		spillFileDead = 0;
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	writeSpillDump(spillFile, spillFileEndno, spillFileEnd, buf.data, buf.len);
+
+	package->spill_fileno = spillFileEndno;
+	package->spill_offset = spillFileEnd;
+	package->spill_size = buf.len;
+	package->spill_nvariables = (int) nvariables;
+	package->spill_nrecords = nrecords;
+	BufFileTell(spillFile, &spillFileEndno, &spillFileEnd);
+	spillFileSize += buf.len;
+	pfree(buf.data);
+
+	freeRegularVariables(package);
+	package->is_spilled = true;
+	spilledPackages++;
 }
 
 /*
- * Remove all packages and variables.
- * Memory context will be released after committing.
+ * Rewrite the spill file with the dumps of spilled packages only. The
+ * packages are switched to the new file when all the dumps are written.
  */
-Datum
-remove_packages(PG_FUNCTION_ARGS)
+static void
+compactSpillFile(void)
 {
-	Package    *package;
+	BufFile    *newFile;
+	MemoryContext oldcxt;
 	HASH_SEQ_STATUS pstat;
+	Package    *package;
+	Package   **packages;
+	int		   *filenos;
+	off_t	   *offsets;
+	int			npackages = 0;
+	int			endno = 0;
+	off_t		end = 0;
+	int			i;
 
-	/* There is no any packages and variables */
-	if (packagesHash == NULL)
-		PG_RETURN_VOID();
-
-	/*
-	 * Need to remove variables before removing packages because
-	 * remove_variables_all() calls hash_seq_term() which uses
-	 * "entry->status->hashp->frozen" but memory context of "hashp"
-	 * for regular variables can be deleted in removePackageInternal().
-	 */
-	remove_variables_all(&variables_stats);
+	packages = (Package **) palloc(spilledPackages * sizeof(Package *));
+	filenos = (int *) palloc(spilledPackages * sizeof(int));
+	offsets = (off_t *) palloc(spilledPackages * sizeof(off_t));
 
-	/* Get packages list */
 	hash_seq_init(&pstat, packagesHash);
 	while ((package = (Package *) hash_seq_search(&pstat)) != NULL)
 	{
-		removePackageInternal(package);
+		if (package->is_spilled)
+			packages[npackages++] = package;
 	}
+	Assert(npackages == spilledPackages);
 
-	resetVariablesCache();
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	newFile = BufFileCreateTemp(true);
+	MemoryContextSwitchTo(oldcxt);
 
-	PG_RETURN_VOID();
+	PG_TRY();
+	{
+		for (i = 0; i < npackages; i++)
+		{
+			StringInfoData buf;
+
+			readSpillDump(packages[i], &buf);
+			writeSpillDump(newFile, endno, end, buf.data, buf.len);
+			filenos[i] = endno;
+			offsets[i] = end;
+			BufFileTell(newFile, &endno, &end);
+			pfree(buf.data);
+		}
+	}
+	PG_CATCH();
+	{
+		BufFileClose(newFile);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	for (i = 0; i < npackages; i++)
+	{
+		packages[i]->spill_fileno = filenos[i];
+		packages[i]->spill_offset = offsets[i];
+	}
+
+	BufFileClose(spillFile);
+	spillFile = newFile;
+	spillFileEndno = endno;
+	spillFileEnd = end;
+	spillFileSize -= spillFileDead;
+	spillFileDead = 0;
+
+	pfree(packages);
+	pfree(filenos);
+	pfree(offsets);
 }
 
 /*
- * Structure for get_packages_and_variables().
+ * Forget the spilled dump of the package. The spill file is closed if there
+ * are no spilled packages anymore.
  */
-typedef struct
+static void
+releaseSpilledPackage(Package *package)
 {
-	char	   *package;
-	char	   *variable;
-	bool		is_transactional;
-}			VariableRec;
+	Assert(package->is_spilled && spilledPackages > 0);
+
+	package->is_spilled = false;
+	spillFileDead += package->spill_size;
+	if (--spilledPackages == 0)
+	{
+		BufFileClose(spillFile);
+		spillFile = NULL;
+	}
+}
 
 /*
- * Get list of assigned packages and variables.
+ * Load spilled regular variables of the package back. The whole dump is
+ * checked before variables are created, like in pgv_load().
  */
-Datum
-get_packages_and_variables(PG_FUNCTION_ARGS)
+static void
+reloadPackage(Package *package)
 {
-	FuncCallContext *funcctx;
-	VariableRec *recs;
-	MemoryContext oldcontext;
+	StringInfoData buf;
+	text	   *package_name;
+	int			pass;
 
-	if (SRF_IS_FIRSTCALL())
-	{
-		TupleDesc	tupdesc;
+	readSpillDump(package, &buf);
 
-		funcctx = SRF_FIRSTCALL_INIT();
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+	package_name = cstring_to_text(GetName(package));
 
-		/* Build a tuple descriptor for our result type */
-		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
-			ereport(ERROR,
-					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-					 errmsg("function returning record called in context "
-							"that cannot accept type record")));
+	for (pass = 0; pass < 2; pass++)
+	{
+		bool		build = (pass == 1);
+		int			i;
 
-		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+		/* Variables are created in the usual way from now on */
+		if (build)
+			package->is_spilled = false;
 
-		/*
-		 * Get all packages and variables names and save them into
-		 * funcctx->user_fctx.
-		 */
-		if (packagesHash)
+		PG_TRY();
 		{
-			Package    *package;
-			HASH_SEQ_STATUS pstat;
-			int			mRecs = NUMVARIABLES,
-						nRecs = 0;
-
-			recs = (VariableRec *) palloc0(sizeof(VariableRec) * mRecs);
-
-			/* Get packages list */
-			hash_seq_init(&pstat, packagesHash);
-			while ((package = (Package *) hash_seq_search(&pstat)) != NULL)
+			buf.cursor = 0;
+			for (i = 0; i < package->spill_nvariables; i++)
+				loadVariable(package_name, &buf, build);
+			pq_getmsgend(&buf);
+		}
+		PG_CATCH();
+		{
+			/* The dump is still there, drop partially loaded variables */
+			if (build)
 			{
-				Variable   *variable;
-				HASH_SEQ_STATUS vstat;
-				int			i;
-
-				/* Skip packages marked as deleted */
-				if (!GetActualState(package)->is_valid)
-					continue;
-
-				/* Get variables list for package */
-				for (i = 0; i < 2; i++)
-				{
-					HTAB	   *htab = pack_htab(package, i);
-
-					if (!htab)
-						continue;
-					hash_seq_init(&vstat, htab);
-					while ((variable =
-							(Variable *) hash_seq_search(&vstat)) != NULL)
-					{
-						if (!GetActualState(variable)->is_valid)
-							continue;
-
-						/* Resize recs if necessary */
-						if (nRecs >= mRecs)
-						{
-							mRecs *= 2;
-							recs = (VariableRec *) repalloc(recs,
-															sizeof(VariableRec) * mRecs);
-						}
-
-						recs[nRecs].package = GetName(package);
-						recs[nRecs].variable = GetName(variable);
-						recs[nRecs].is_transactional = variable->is_transactional;
-						nRecs++;
-					}
-				}
+				freeRegularVariables(package);
+				package->is_spilled = true;
 			}
-
-			funcctx->user_fctx = recs;
-			funcctx->max_calls = nRecs;
+			PG_RE_THROW();
 		}
-		else
-			funcctx->max_calls = 0;
-
-		MemoryContextSwitchTo(oldcontext);
+		PG_END_TRY();
 	}
 
-	funcctx = SRF_PERCALL_SETUP();
+	/* The dump isn't needed anymore, mark it to release */
+	package->is_spilled = true;
+	releaseSpilledPackage(package);
+	package->last_used = GetCurrentStatementStartTimestamp();
 
-	/* Get the saved recs */
-	recs = (VariableRec *) funcctx->user_fctx;
+	pfree(package_name);
+	pfree(buf.data);
+}
 
-	if (funcctx->call_cntr < funcctx->max_calls)
+/*
+ * Put names of spilled variables of the package into the result of
+ * pgv_list(). The dump is only parsed, the variables stay spilled.
+ */
+static void
+listSpilledVariables(Package *package, Tuplestorestate *tupstore,
+					 TupleDesc tupdesc)
+{
+	StringInfoData buf;
+	int			i;
+
+	readSpillDump(package, &buf);
+
+	for (i = 0; i < package->spill_nvariables; i++)
 	{
+		char		name[NAMEDATALEN];
+		int			cursor = buf.cursor;
 		Datum		values[3];
 		bool		nulls[3];
-		HeapTuple	tuple;
-		Datum		result;
-		int			i = funcctx->call_cntr;
 
+		load_name(&buf, name);
+		buf.cursor = cursor;
+		/* Skip the rest of the variable */
+		loadVariable(NULL, &buf, false);
+
+		/* Only packages without transactional variables are spilled */
 		memset(nulls, 0, sizeof(nulls));
+		values[0] = PointerGetDatum(cstring_to_text(GetName(package)));
+		values[1] = PointerGetDatum(cstring_to_text(name));
+		values[2] = BoolGetDatum(false);
 
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
-
-		values[0] = PointerGetDatum(cstring_to_text(recs[i].package));
-		values[1] = PointerGetDatum(cstring_to_text(recs[i].variable));
-		values[2] = recs[i].is_transactional;
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+	pq_getmsgend(&buf);
 
-		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
-		result = HeapTupleGetDatum(tuple);
+	pfree(buf.data);
+}
 
-		MemoryContextSwitchTo(oldcontext);
+static int
+compareLastUsed(const void *a, const void *b)
+{
+	TimestampTz t1 = (*(Package *const *) a)->last_used;
+	TimestampTz t2 = (*(Package *const *) b)->last_used;
 
-		SRF_RETURN_NEXT(funcctx, result);
-	}
-	else
-		SRF_RETURN_DONE(funcctx);
+	return t1 < t2 ? -1 : (t1 > t2 ? 1 : 0);
 }
 
+/*
+ * Spill regular variables of packages, which haven't been used for
+ * pg_variables.spill_timeout, and of least recently used packages while the
+ * memory used by variables exceeds pg_variables.spill_memory. It is done at
+ * commit of a transaction, spilled packages are loaded back by getPackage().
+ */
 static void
-getMemoryTotalSpace(MemoryContext context, int level, Size *totalspace)
+spillPackages(void)
 {
-#if PG_VERSION_NUM >= 90600
-	MemoryContext child;
-	MemoryContextCounters totals;
-
-	Assert(MemoryContextIsValid(context));
+	TimestampTz now;
+	Size		allocated = 0;
+	Size		limit = (Size) spill_memory * 1024;
+	bool		check_timeout;
+	HASH_SEQ_STATUS pstat;
+	Package    *package;
+	Package   **packages;
+	int			npackages = 0;
+	int			i;
 
-	/* Examine the context itself */
-	memset(&totals, 0, sizeof(totals));
-#if PG_VERSION_NUM >= 140000
-	(*context->methods->stats) (context, NULL, NULL, &totals, true);
-#elif PG_VERSION_NUM >= 110000
-	(*context->methods->stats) (context, NULL, NULL, &totals);
-#else
-	(*context->methods->stats) (context, level, false, &totals);
+	if ((spill_memory == 0 && spill_timeout == 0) || packagesHash == NULL)
+		return;
+#ifdef PGPRO_EE
+	if (getNestLevelATX() > 0)
+		return;
 #endif
-	*totalspace += totals.totalspace;
+
+	/* Packages which haven't been used for long are looked for once a second */
+	now = GetCurrentTimestamp();
+	check_timeout = spill_timeout > 0 &&
+		TimestampDifferenceExceeds(lastSpillCheck, now, 1000);
+	if (spill_memory > 0)
+		allocated = getMemoryAllocated(ModuleContext);
+	if (!check_timeout && !(spill_memory > 0 && allocated > limit))
+		return;
+	if (check_timeout)
+		lastSpillCheck = now;
+
+	packages = (Package **) palloc(hash_get_num_entries(packagesHash) *
+								   sizeof(Package *));
+	hash_seq_init(&pstat, packagesHash);
+	while ((package = (Package *) hash_seq_search(&pstat)) != NULL)
+	{
+		if (isPackageSpillable(package))
+			packages[npackages++] = package;
+	}
+
+	qsort(packages, npackages, sizeof(Package *), compareLastUsed);
+
+	if (spillFile != NULL && spillFileDead > spillFileSize - spillFileDead)
+		compactSpillFile();
 
 	/*
-	 * Examine children.
+	 * An error aborts the commit. A package is marked as spilled only when its
+	 * dump is written, so packages are consistent then.
 	 */
-	for (child = context->firstchild; child != NULL; child = child->nextchild)
-		getMemoryTotalSpace(child, level + 1, totalspace);
-#else
-	*totalspace = 0;
-#endif
+	for (i = 0; i < npackages; i++)
+	{
+		package = packages[i];
+
+		if (!(check_timeout &&
+			  TimestampDifferenceExceeds(package->last_used, now,
+										 spill_timeout * 1000)) &&
+			!(spill_memory > 0 && allocated > limit))
+			break;
+
+		/* Cached pointers to spilled variables must not be used */
+		if (i == 0)
+			resetVariablesCache();
+
+		allocated -= Min(allocated, getMemoryAllocated(package->hctxRegular));
+		spillPackage(package);
+	}
+
+	pfree(packages);
 }
 
+/* Rows estimate of pgv_select() if the variable is unknown at planning */
+#define PGV_DEFAULT_ROWS	1000
+
 /*
- * Get list of assigned packages and used memory in bytes.
+ * Get the value of the argument of pgv_select() known at planning. The
+ * planner may ask for costs without PlannerInfo, only constants are known
+ * then.
  */
-Datum
-get_packages_stats(PG_FUNCTION_ARGS)
+static Node *
+estimateArgument(PlannerInfo *root, Node *arg)
 {
-	FuncCallContext *funcctx;
-	MemoryContext oldcontext;
-	HASH_SEQ_STATUS *rstat;
-	Package    *package;
-
-	if (SRF_IS_FIRSTCALL())
-	{
-		TupleDesc	tupdesc;
+	if (root == NULL)
+		return arg;
+	return estimate_expression_value(root, arg);
+}
 
-		funcctx = SRF_FIRSTCALL_INIT();
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+/*
+ * Find the record variable to estimate its records. Unlike getVariable(), the
+ * cache of variables isn't used, a spilled package isn't loaded back and the
+ * time of the last use of the package isn't changed. Returns NULL if there is
+ * no such a valid variable or its package is spilled.
+ */
+static Variable *
+findVariableToEstimate(text *package_name, text *var_name)
+{
+	char		key[NAMEDATALEN];
+	Package    *package;
+	Variable   *variable = NULL;
+	bool		found = false;
 
-		/* Build a tuple descriptor for our result type */
-		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
-			ereport(ERROR,
-					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-					 errmsg("function returning record called in context "
-							"that cannot accept type record")));
+	if (packagesHash == NULL ||
+		VARSIZE_ANY_EXHDR(package_name) >= NAMEDATALEN - 1 ||
+		VARSIZE_ANY_EXHDR(var_name) >= NAMEDATALEN - 1)
+		return NULL;
 
-		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+	getKeyFromName(package_name, key);
+	package = (Package *) hash_search(packagesHash, key, HASH_FIND, NULL);
+	if (package == NULL || !GetActualState(package)->is_valid ||
+		package->is_spilled)
+		return NULL;
 
-		/*
-		 * Get all packages and variables names and save them into
-		 * funcctx->user_fctx.
-		 */
-		if (packagesHash)
-		{
-			MemoryContext ctx;
-			PackageStatEntry *entry;
+	getKeyFromName(var_name, key);
+	if (package->varHashRegular)
+		variable = (Variable *) hash_search(package->varHashRegular,
+											key, HASH_FIND, &found);
+	if (!found && package->varHashTransact)
+		variable = (Variable *) hash_search(package->varHashTransact,
+											key, HASH_FIND, &found);
 
-			ctx = MemoryContextSwitchTo(TopTransactionContext);
-			rstat = (HASH_SEQ_STATUS *) palloc0(sizeof(HASH_SEQ_STATUS));
-			/* Get packages list */
-			hash_seq_init(rstat, packagesHash);
+	if (!found || !variable->is_record ||
+		!GetActualState(variable)->is_valid)
+		return NULL;
 
-			funcctx->user_fctx = rstat;
-			entry = palloc0(sizeof(PackageStatEntry));
-			entry->status = rstat;
-			entry->levels.level = GetCurrentTransactionNestLevel();
-#ifdef PGPRO_EE
-			entry->levels.atxlevel = getNestLevelATX();
-#endif
-			entry->user_fctx = &funcctx->user_fctx;
-			packages_stats = lcons((void *) entry, packages_stats);
-			MemoryContextSwitchTo(ctx);
-		}
-		else
-			funcctx->user_fctx = NULL;
+	return variable;
+}
 
-		MemoryContextSwitchTo(oldcontext);
-	}
+/*
+ * Get the number of records of the variable given by the first two arguments
+ * of pgv_select(), if they are constants. Returns 0 if any of them is NULL and
+ * -1 if the variable is unknown or its package is spilled.
+ */
+static double
+estimateRecordsNumber(PlannerInfo *root, List *args)
+{
+	Node	   *arg1,
+			   *arg2;
+	Variable   *variable;
+	RecordVar  *record;
 
-	funcctx = SRF_PERCALL_SETUP();
-	if (funcctx->user_fctx == NULL)
-		SRF_RETURN_DONE(funcctx);
+	arg1 = estimateArgument(root, linitial(args));
+	arg2 = estimateArgument(root, lsecond(args));
 
-	/* Get packages list */
-	rstat = (HASH_SEQ_STATUS *) funcctx->user_fctx;
+	if ((IsA(arg1, Const) && ((Const *) arg1)->constisnull) ||
+		(IsA(arg2, Const) && ((Const *) arg2)->constisnull))
+		return 0;
 
-	package = (Package *) hash_seq_search(rstat);
-	if (package != NULL)
-	{
-		Datum		values[2];
-		bool		nulls[2];
-		HeapTuple	tuple;
-		Datum		result;
-		Size		totalSpace = 0,
-					regularSpace = 0,
-					transactSpace = 0;
+	if (!IsA(arg1, Const) || !IsA(arg2, Const))
+		return -1;
 
-		memset(nulls, 0, sizeof(nulls));
+	variable = findVariableToEstimate(DatumGetTextPP(((Const *) arg1)->constvalue),
+									  DatumGetTextPP(((Const *) arg2)->constvalue));
+	if (variable == NULL)
+		return -1;
 
-		/* Fill data */
-		values[0] = PointerGetDatum(cstring_to_text(GetName(package)));
+	record = &(GetActualValue(variable).record);
+	if (record->rhash == NULL)
+		return 0;
 
-		if (package->hctxRegular)
-			getMemoryTotalSpace(package->hctxRegular, 0, &regularSpace);
-		if (package->hctxTransact)
-			getMemoryTotalSpace(package->hctxTransact, 0, &transactSpace);
+	return (double) hash_get_num_entries(record->rhash);
+}
 
-		totalSpace = regularSpace + transactSpace;
-		values[1] = Int64GetDatum(totalSpace);
+/*
+ * Get the number of elements of the array argument of pgv_select(), if it is
+ * a constant. Returns -1 otherwise.
+ */
+static double
+estimateArrayNumber(PlannerInfo *root, Node *arg)
+{
+	ArrayType  *values;
 
-		/* Data are ready */
-		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
-		result = HeapTupleGetDatum(tuple);
+	arg = estimateArgument(root, arg);
+	if (!IsA(arg, Const))
+		return -1;
+	if (((Const *) arg)->constisnull)
+		return 0;
 
-		SRF_RETURN_NEXT(funcctx, result);
-	}
-	else
-	{
-		remove_packages_status(&packages_stats, rstat);
-		SRF_RETURN_DONE(funcctx);
-	}
+	values = DatumGetArrayTypeP(((Const *) arg)->constvalue);
+	return (double) ArrayGetNItems(ARR_NDIM(values), ARR_DIMS(values));
 }
 
 /*
- * Planner support function for variable_select(text, text)
+ * Planner support function for pgv_select() functions.
+ *
+ * Rows of pgv_select(package, name) are estimated by the number of records of
+ * the variable and of pgv_select(package, name, anyarray) by the number of
+ * searched keys. The cost of a call is the cost of fetching or searching for
+ * every record.
  */
 Datum
 variable_select_support(PG_FUNCTION_ARGS)
 {
-	Node* rawreq = (Node*)PG_GETARG_POINTER(0);
-	Node* ret = NULL;
+	Node	   *rawreq = (Node *) PG_GETARG_POINTER(0);
+	Node	   *ret = NULL;
 
 	if (IsA(rawreq, SupportRequestRows))
 	{
 		/* Try to estimate the number of rows returned */
-		SupportRequestRows* req = (SupportRequestRows*)rawreq;
+		SupportRequestRows *req = (SupportRequestRows *) rawreq;
 
 		if (is_funcclause(req->node))	/* be paranoid */
 		{
-			List* args = ((FuncExpr*)req->node)->args;
-			Node* arg1, * arg2;
+			List	   *args = ((FuncExpr *) req->node)->args;
+			double		nrecords = estimateRecordsNumber(req->root, args);
 
-			arg1 = estimate_expression_value(req->root, linitial(args));
-			arg2 = estimate_expression_value(req->root, lsecond(args));
-			req->rows = 1000;
-
-			if ((IsA(arg1, Const) &&
-				((Const*)arg1)->constisnull) ||
-				(IsA(arg2, Const) &&
-					((Const*)arg2)->constisnull))
-			{
-				req->rows = 0;
-			}
-			else if (IsA(arg1, Const) &&
-				IsA(arg2, Const))
+			if (list_length(args) == 2)
+				req->rows = nrecords >= 0 ? nrecords : PGV_DEFAULT_ROWS;
+			else
 			{
-				text* package_name;
-				text* var_name;
-				Package* package;
-				Variable* variable;
-				MemoryContext context;
-				RecordVar* record;
-
-				package_name = (text*)DatumGetPointer(((Const*)arg1)->constvalue);
-				var_name = (text*)DatumGetPointer(((Const*)arg2)->constvalue);
-
-
-				package = getPackage(package_name, false);
-
-				if (package != NULL)
-				{
-
-					variable = getVariableInternal(package, var_name, RECORDOID, true,
-						false);
-
-					if (variable != NULL)
-					{
+				double		nkeys = estimateArrayNumber(req->root,
+														lthird(args));
 
-						int rows = 0;
-
-						record = &(GetActualValue(variable).record);
+				if (nkeys < 0)
+					nkeys = PGV_DEFAULT_ROWS;
+				/* Every key finds one record at most */
+				req->rows = nrecords >= 0 ? Min(nkeys, nrecords) : nkeys;
+			}
 
-						context = record->hctx;
+			ret = (Node *) req;
+		}
+	}
+	else if (IsA(rawreq, SupportRequestCost))
+	{
+		/* Estimate the cost of the function call */
+		SupportRequestCost *req = (SupportRequestCost *) rawreq;
 
-						rows = ((int)context->firstchild->mem_allocated) / 128;
+		if (req->node && is_funcclause(req->node))
+		{
+			FuncExpr   *func = (FuncExpr *) req->node;
+			List	   *args = func->args;
+			double		nrows;
 
-						req->rows = rows;
-					}
-				}
+			if (list_length(args) == 2)
+			{
+				/* All the records are fetched */
+				nrows = estimateRecordsNumber(req->root, args);
+				if (nrows < 0)
+					nrows = PGV_DEFAULT_ROWS;
+			}
+			else if (func->funcretset)
+			{
+				/* Every key of the array is searched for */
+				nrows = estimateArrayNumber(req->root, lthird(args));
+				if (nrows < 0)
+					nrows = PGV_DEFAULT_ROWS;
 			}
+			else
+				/* A single key is searched for */
+				nrows = 1;
 
-			ret = (Node*)req;
+			req->startup = 0;
+			req->per_tuple = cpu_operator_cost * (1 + nrows);
+
+			ret = (Node *) req;
 		}
 	}
 
@@ -1857,7 +4975,7 @@ variable_select_support(PG_FUNCTION_ARGS)
  * Static functions
  */
 
-static void
+void
 getKeyFromName(text *name, char *key)
 {
 	int			key_len = VARSIZE_ANY_EXHDR(name);
@@ -1978,6 +5096,9 @@ getPackage(text *name, bool strict)
 		{
 			Assert(GetPackState(package)->trans_var_num +
 				   numOfRegVars(package) > 0);
+			package->last_used = GetCurrentStatementStartTimestamp();
+			if (package->is_spilled)
+				reloadPackage(package);
 			return package;
 		}
 	}
@@ -2007,6 +5128,9 @@ createPackage(text *name, bool is_trans)
 	{
 		TransObject *transObj = &package->transObject;
 
+		if (package->is_spilled)
+			reloadPackage(package);
+
 		if (!isObjectChangedInCurrentTrans(transObj))
 			createSavepoint(transObj, TRANS_PACKAGE);
 
@@ -2045,8 +5169,10 @@ createPackage(text *name, bool is_trans)
 #ifdef PGPRO_EE
 		package->context = NULL;
 #endif
+		package->is_spilled = false;
 		initObjectHistory(&package->transObject, TRANS_PACKAGE);
 	}
+	package->last_used = GetCurrentStatementStartTimestamp();
 
 	/* Create corresponding HTAB if not exists */
 	if (!pack_htab(package, is_trans))
@@ -2226,28 +5352,31 @@ copyValue(VarState *src, VarState *dest, Variable *destVar)
 {
 	MemoryContext oldcxt;
 
+	PERF_COUNT(savepoint_copies, 1);
+
 	oldcxt = MemoryContextSwitchTo(destVar->package->hctxTransact);
 
 	if (destVar->is_record)
 		/* copy record value */
 	{
-		HASH_SEQ_STATUS rstat;
-		HashRecordEntry *item_src;
-		RecordVar  *record_src = &src->value.record;
-		RecordVar  *record_dest = &dest->value.record;
-
-		init_record(record_dest, record_src->tupdesc, destVar);
-
-		/* Copy previous history entry into the new one */
-		hash_seq_init(&rstat, record_src->rhash);
-		while ((item_src = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
-			insert_record_copy(record_dest, item_src->tuple, destVar);
+		/*
+		 * Records aren't copied. The new state shares them with the previous
+		 * one and keeps original versions of records changed within it. See
+		 * removeState() and releaseSavepoint().
+		 */
+		dest->value.record = src->value.record;
+		if (src->value.record.rhash)
+			dest->changes = make_record_changes(destVar);
 	}
 	else
 		/* copy scalar value */
 	{
 		ScalarVar  *scalar = &dest->value.scalar;
 
+		if (!src->value.scalar.is_null && !src->value.scalar.typbyval)
+			check_memory_limit(datumGetSize(src->value.scalar.value, false,
+											src->value.scalar.typlen));
+
 		*scalar = src->value.scalar;
 		if (!scalar->is_null)
 			scalar->value = datumCopy(src->value.scalar.value,
@@ -2270,7 +5399,12 @@ freeValue(VarState *varstate, bool is_record)
 	else if (!is_record && varstate->value.scalar.typbyval == false &&
 			 varstate->value.scalar.is_null == false &&
 			 varstate->value.scalar.value)
-		pfree(DatumGetPointer(varstate->value.scalar.value));
+	{
+		ScalarVar  *scalar = &varstate->value.scalar;
+
+		release_memory(datumGetSize(scalar->value, false, scalar->typlen));
+		pfree(DatumGetPointer(scalar->value));
+	}
 }
 
 static void
@@ -2279,13 +5413,56 @@ removeState(TransObject *object, TransObjectType type, TransState *stateToDelete
 	if (type == TRANS_VARIABLE)
 	{
 		Variable   *var = (Variable *) object;
+		VarState   *varState = (VarState *) stateToDelete;
+
+		if (var->is_record && varState->changes)
+		{
+			VarState   *prevState;
+
+			/*
+			 * Records are shared with the previous state. Undo the changes and
+			 * give records back to it.
+			 */
+			Assert(dlist_has_next(&object->states, &stateToDelete->node));
+			prevState = (VarState *) dlist_container(TransState, node,
+													 stateToDelete->node.next);
 
-		freeValue((VarState *) stateToDelete, var->is_record);
+			rollback_record_changes(&varState->value.record,
+									varState->changes);
+			prevState->value.record = varState->value.record;
+		}
+		else
+			freeValue(varState, var->is_record);
 	}
 	dlist_delete(&stateToDelete->node);
 	pfree(stateToDelete);
 }
 
+/*
+ * Prepare the previous state of record variable to be removed on release of
+ * the actual state, which shares records with it. Changes of the actual state
+ * are merged into changes of the previous state, so the actual state takes
+ * over its records.
+ */
+static void
+releaseRecordState(VarState *state, VarState *prevState)
+{
+	RecordVar  *record = &state->value.record;
+
+	if (prevState->changes)
+		state->changes = merge_record_changes(record, state->changes,
+											  prevState->changes);
+	else
+	{
+		/* The previous state owns records, nothing to undo anymore */
+		discard_record_changes(record, state->changes);
+		state->changes = NULL;
+	}
+
+	prevState->changes = NULL;
+	memset(&prevState->value.record, 0, sizeof(RecordVar));
+}
+
 /* Remove package or variable (either transactional or regular) */
 bool
 removeObject(TransObject *object, TransObjectType type)
@@ -2315,6 +5492,9 @@ removeObject(TransObject *object, TransObjectType type)
 
 		package = (Package *) object;
 
+		if (package->is_spilled)
+			releaseSpilledPackage(package);
+
 		/* Regular variables had already removed */
 		if (package->hctxRegular)
 			MemoryContextDelete(package->hctxRegular);
@@ -2405,7 +5585,9 @@ createSavepoint(TransObject *object, TransObjectType type)
 static int
 numOfRegVars(Package *package)
 {
-	if (package->varHashRegular)
+	if (package->is_spilled)
+		return package->spill_nvariables;
+	else if (package->varHashRegular)
 		return hash_get_num_entries(package->varHashRegular);
 	else
 		return 0;
@@ -2426,6 +5608,9 @@ rollbackSavepoint(TransObject *object, TransObjectType type, bool sub)
 		return;
 	}
 
+	/* The object may become invalid, don't use cached pointers to it */
+	resetVariablesCache();
+
 	state = GetActualState(object);
 	removeState(object, type, state);
 
@@ -2450,7 +5635,7 @@ rollbackSavepoint(TransObject *object, TransObjectType type, bool sub)
 				GetActualState(object)->levels.atxlevel = sub ? getNestLevelATX() : 0;
 #endif
 				GetActualState(object)->levels.level = GetCurrentTransactionNestLevel() - 1;
-				if (!dlist_is_empty(changesStack))
+				if (sub)
 					addToChangesStackUpperLevel(object, type);
 			}
 			else
@@ -2464,13 +5649,12 @@ rollbackSavepoint(TransObject *object, TransObjectType type, bool sub)
 		 */
 		else if (isPackageEmpty((Package *) object))
 		{
-			if (dlist_is_empty(changesStack))
+			if (!sub)
 			{
 				removeObject(object, type);
 				return;
 			}
-			else if (!isObjectChangedInUpperTrans(object) &&
-					 !dlist_is_empty(changesStack))
+			else if (!isObjectChangedInUpperTrans(object))
 			{
 				createSavepoint(object, type);
 				addToChangesStackUpperLevel(object, type);
@@ -2508,9 +5692,7 @@ releaseSavepoint(TransObject *object, TransObjectType type, bool sub)
 	 * we complete the transaction) - remove object.
 	 */
 	if (!GetActualState(object)->is_valid &&
-		(!dlist_has_next(states, dlist_head_node(states)) ||
-		 dlist_is_empty(changesStack))
-		)
+		(!dlist_has_next(states, dlist_head_node(states)) || !sub))
 	{
 		if (removeObject(object, type))
 			return;
@@ -2536,6 +5718,10 @@ releaseSavepoint(TransObject *object, TransObjectType type, bool sub)
 		Assert(type != TRANS_PACKAGE || getNestLevelATX() == 0 ||
 			   stateToDelete->levels.atxlevel == getNestLevelATX());
 #endif
+		if (type == TRANS_VARIABLE && ((Variable *) object)->is_record &&
+			((VarState *) GetActualState(object))->changes)
+			releaseRecordState((VarState *) GetActualState(object),
+							   (VarState *) stateToDelete);
 		removeState(object, type, stateToDelete);
 	}
 
@@ -2543,7 +5729,7 @@ releaseSavepoint(TransObject *object, TransObjectType type, bool sub)
 	 * If the object does not yet have a record in previous level
 	 * changesStack, create it.
 	 */
-	else if (!dlist_is_empty(changesStack))
+	else if (sub)
 		addToChangesStackUpperLevel(object, type);
 
 	/* Change subxact level due to release */
@@ -2566,7 +5752,7 @@ addToChangesStackUpperLevel(TransObject *object, TransObjectType type)
 	 * Impossible to push in upper list existing node because it was created
 	 * in another context
 	 */
-	csn = dlist_head_element(ChangesStackNode, node, changesStack);
+	csn = getChangesStackNode(GetCurrentTransactionNestLevel() - 1);
 	co_new = makeChangedObject(object, csn->ctx);
 	dlist_push_head(type == TRANS_PACKAGE ? csn->changedPacksList :
 					csn->changedVarsList,
@@ -2639,60 +5825,83 @@ isObjectChangedInUpperTrans(TransObject *object)
 }
 
 /*
- * Create a new list of variables, changed in current transaction level
+ * Create a new list of objects, changed in the given transaction level
  */
-static void
-pushChangesStack(void)
+static ChangesStackNode *
+pushChangesStack(int level)
 {
 	MemoryContext oldcxt;
 	ChangesStackNode *csn;
 
-	/*
-	 * Initialize changesStack and create MemoryContext for it if not done
-	 * before.
-	 */
-	if (!changesStackContext)
-		changesStackContext = AllocSetContextCreate(ModuleContext,
-													PGV_MCXT_STACK,
-													ALLOCSET_START_SMALL_SIZES);
-	Assert(changesStackContext);
+	Assert(changesStack && changesStackContext);
 	oldcxt = MemoryContextSwitchTo(changesStackContext);
 
-	if (!changesStack)
+	if (changesStackFree && !dlist_is_empty(changesStackFree))
 	{
-		changesStack = palloc0(sizeof(dlist_head));
-		dlist_init(changesStack);
+		/* Reuse the node of finished subxact, its context is reset already */
+		csn = dlist_container(ChangesStackNode, node,
+							  dlist_pop_head_node(changesStackFree));
 	}
-	Assert(changesStack);
-	csn = palloc0(sizeof(ChangesStackNode));
-	csn->changedVarsList = palloc0(sizeof(dlist_head));
-	csn->changedPacksList = palloc0(sizeof(dlist_head));
+	else
+	{
+		csn = palloc0(sizeof(ChangesStackNode));
+		csn->changedVarsList = palloc0(sizeof(dlist_head));
+		csn->changedPacksList = palloc0(sizeof(dlist_head));
 
-	csn->ctx = AllocSetContextCreate(changesStackContext,
-									 PGV_MCXT_STACK_NODE,
-									 ALLOCSET_START_SMALL_SIZES);
+		csn->ctx = AllocSetContextCreate(changesStackContext,
+										 PGV_MCXT_STACK_NODE,
+										 ALLOCSET_START_SMALL_SIZES);
+	}
 
+	csn->level = level;
 	dlist_init(csn->changedVarsList);
 	dlist_init(csn->changedPacksList);
 	dlist_push_head(changesStack, &csn->node);
 
 	MemoryContextSwitchTo(oldcxt);
+
+	return csn;
+}
+
+/*
+ * Get the list of objects, changed in the given transaction level. Lists are
+ * created on the first change within a level, so levels without changes cost
+ * nothing. Only the current level or its parent may be requested.
+ */
+static ChangesStackNode *
+getChangesStackNode(int level)
+{
+	if (!dlist_is_empty(changesStack))
+	{
+		ChangesStackNode *csn;
+
+		csn = dlist_head_element(ChangesStackNode, node, changesStack);
+		if (csn->level == level)
+			return csn;
+		Assert(csn->level < level);
+	}
+
+	return pushChangesStack(level);
 }
 
 /*
- * Create a changesStack with the required depth.
+ * Create an empty changesStack if it doesn't exist. Lists of levels are
+ * created by getChangesStackNode().
  */
 static void
 prepareChangesStack(void)
 {
 	if (!changesStack)
 	{
-		int			level = GetCurrentTransactionNestLevel();
-
-		while (level-- > 0)
-		{
-			pushChangesStack();
-		}
+		/* Create MemoryContext for changesStack if not done before */
+		if (!changesStackContext)
+			changesStackContext = AllocSetContextCreate(ModuleContext,
+														PGV_MCXT_STACK,
+														ALLOCSET_START_SMALL_SIZES);
+
+		changesStack = MemoryContextAlloc(changesStackContext,
+										  sizeof(dlist_head));
+		dlist_init(changesStack);
 	}
 }
 
@@ -2724,7 +5933,7 @@ addToChangesStack(TransObject *object, TransObjectType type)
 		ChangesStackNode *csn;
 		ChangedObject *co;
 
-		csn = get_actual_changes_list();
+		csn = getChangesStackNode(GetCurrentTransactionNestLevel());
 		co = makeChangedObject(object, csn->ctx);
 		dlist_push_head(type == TRANS_PACKAGE ? csn->changedPacksList :
 						csn->changedVarsList, &co->node);
@@ -2794,33 +6003,59 @@ applyAction(Action action, TransObjectType type, dlist_head *list, bool sub)
 static void
 processChanges(Action action, bool sub)
 {
-	ChangesStackNode *bottom_list;
+	ChangesStackNode *bottom_list = NULL;
 
 	Assert(changesStack && changesStackContext);
-	/* List removed from stack but we still can use it */
-	bottom_list = dlist_container(ChangesStackNode, node,
-								  dlist_pop_head_node(changesStack));
 
-	applyAction(action, TRANS_VARIABLE, bottom_list->changedVarsList, sub);
-	applyAction(action, TRANS_PACKAGE, bottom_list->changedPacksList, sub);
+	/* There is nothing to do if no objects were changed in this level */
+	if (!dlist_is_empty(changesStack))
+	{
+		bottom_list = dlist_head_element(ChangesStackNode, node, changesStack);
+		if (bottom_list->level != GetCurrentTransactionNestLevel())
+			bottom_list = NULL;
+	}
+
+	if (bottom_list)
+	{
+		/* List removed from stack but we still can use it */
+		dlist_delete(&bottom_list->node);
+
+		applyAction(action, TRANS_VARIABLE, bottom_list->changedVarsList, sub);
+		applyAction(action, TRANS_PACKAGE, bottom_list->changedPacksList, sub);
+
+		/*
+		 * Clear changes list of current level and keep it for next subxacts,
+		 * so they don't create memory contexts.
+		 */
+		MemoryContextReset(bottom_list->ctx);
+		if (!changesStackFree)
+		{
+			changesStackFree = MemoryContextAlloc(changesStackContext,
+												  sizeof(dlist_head));
+			dlist_init(changesStackFree);
+		}
+		dlist_push_head(changesStackFree, &bottom_list->node);
+	}
 
-	/* Remove changes list of current level */
-	MemoryContextDelete(bottom_list->ctx);
-	/* Remove the stack if it is empty */
-	if (dlist_is_empty(changesStack))
+	/* Remove the stack at the end of transaction */
+	if (!sub)
 	{
+		Assert(dlist_is_empty(changesStack));
 		MemoryContextDelete(changesStackContext);
 		changesStack = NULL;
 		changesStackContext = NULL;
+		changesStackFree = NULL;
 	}
 	if (!hash_get_num_entries(packagesHash))
 	{
 		MemoryContextDelete(ModuleContext);
 		packagesHash = NULL;
 		ModuleContext = NULL;
+		allocatedMemory = 0;
 		resetVariablesCache();
 		changesStack = NULL;
 		changesStackContext = NULL;
+		changesStackFree = NULL;
 	}
 }
 
@@ -2911,6 +6146,8 @@ pgvSaveContext(void)
 	changesStack = NULL;
 	sus->changesStackContext = changesStackContext;
 	changesStackContext = NULL;
+	sus->changesStackFree = changesStackFree;
+	changesStackFree = NULL;
 
 	sus->next = pgv_context;
 	pgv_context = sus;
@@ -2933,6 +6170,7 @@ pgvRestoreContext()
 		MemoryContextDelete(changesStackContext);
 		changesStack = NULL;
 		changesStackContext = NULL;
+		changesStackFree = NULL;
 	}
 	/* We just finished ATX => need to free all hash_seq_search scans */
 	freeStatsLists();
@@ -3014,6 +6252,7 @@ pgvRestoreContext()
 		/* Restore changes stack for previous level: */
 		changesStack = sus->changesStack;
 		changesStackContext = sus->changesStackContext;
+		changesStackFree = sus->changesStackFree;
 
 		pgv_context = sus->next;
 		pfree(sus);
@@ -3035,7 +6274,7 @@ pgvSubTransCallback(SubXactEvent event, SubTransactionId mySubid,
 		switch (event)
 		{
 			case SUBXACT_EVENT_START_SUB:
-				pushChangesStack();
+				/* Changes list of the level is created on the first change */
 				compatibility_check();
 				break;
 			case SUBXACT_EVENT_COMMIT_SUB:
@@ -3088,6 +6327,9 @@ pgvTransCallback(XactEvent event, void *arg)
 	if (event == XACT_EVENT_PRE_COMMIT || event == XACT_EVENT_ABORT)
 		freeStatsLists();
 
+	if (event == XACT_EVENT_PRE_COMMIT)
+		spillPackages();
+
 #ifdef PGPRO_EE
 	if (getNestLevelATX() > 0)
 	{
@@ -3120,17 +6362,21 @@ variable_ExecutorEnd(QueryDesc *queryDesc)
 }
 
 /*
- * Free hash_seq_search scans
+ * Free hash_seq_search scans. The entries are marked as removed from the
+ * lists, see removeVariableStatEntry().
  */
 static void
 freeStatsLists(void)
 {
-	ListCell   *cell;
+	dlist_mutable_iter iter;
 
-	foreach(cell, variables_stats)
+	dlist_foreach_modify(iter, &variables_stats)
 	{
-		VariableStatEntry *entry = (VariableStatEntry *) lfirst(cell);
+		VariableStatEntry *entry = (VariableStatEntry *) iter.cur;
 
+		entry->node.next = entry->node.prev = NULL;
+		if (entry->status == NULL)
+			continue;
 #ifdef PGPRO_EE
 		hash_seq_term_all_levels(entry->status);
 #else
@@ -3138,12 +6384,13 @@ freeStatsLists(void)
 #endif
 	}
 
-	variables_stats = NIL;
+	dlist_init(&variables_stats);
 
-	foreach(cell, packages_stats)
+	dlist_foreach_modify(iter, &packages_stats)
 	{
-		PackageStatEntry *entry = (PackageStatEntry *) lfirst(cell);
+		PackageStatEntry *entry = (PackageStatEntry *) iter.cur;
 
+		entry->node.next = entry->node.prev = NULL;
 #ifdef PGPRO_EE
 		hash_seq_term_all_levels(entry->status);
 #else
@@ -3151,7 +6398,7 @@ freeStatsLists(void)
 #endif
 	}
 
-	packages_stats = NIL;
+	dlist_init(&packages_stats);
 }
 
 /*
@@ -3171,6 +6418,69 @@ _PG_init(void)
 							 NULL,
 							 NULL);
 
+	DefineCustomIntVariable("pg_variables.max_memory",
+							"Maximum amount of memory used by variables of the session, 0 disables the limit.",
+							NULL,
+							&max_memory,
+							0,
+							0,
+							MAX_KILOBYTES,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_variables.compression_threshold",
+							"Size in bytes above which stored text, jsonb and other varlena values are compressed, 0 disables compression.",
+							NULL,
+							&compression_threshold,
+							0,
+							0,
+							MaxAllocSize,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_variables.spill_memory",
+							"Memory used by variables of the session above which rarely used packages are spilled to a temporary file, 0 disables spilling.",
+							NULL,
+							&spill_memory,
+							0,
+							0,
+							MAX_KILOBYTES,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_variables.spill_timeout",
+							"Time after which unused packages are spilled to a temporary file, 0 disables spilling.",
+							NULL,
+							&spill_timeout,
+							0,
+							0,
+							PG_INT32_MAX / 1000,
+							PGC_USERSET,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("pg_variables.track_perf_stats",
+							 "Collects counters of work done by the session, see pgv_perf_stats().",
+							 NULL,
+							 &track_perf_stats,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
 #ifdef PGPRO_EE
 	PgproRegisterXactCallback(pgvTransCallback, NULL, XACT_EVENT_KIND_VANILLA | XACT_EVENT_KIND_ATX);
 #else
@@ -3181,6 +6491,8 @@ _PG_init(void)
 	/* Install hooks. */
 	prev_ExecutorEnd = ExecutorEnd_hook;
 	ExecutorEnd_hook = variable_ExecutorEnd;
+
+	init_shared_variables();
 }
 
 #if PG_VERSION_NUM < 150000
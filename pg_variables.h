@@ -21,6 +21,7 @@
 #include "utils/numeric.h"
 #include "utils/jsonb.h"
 #include "lib/ilist.h"
+#include "lib/stringinfo.h"
 
 /* Accessor for the i'th attribute of tupdesc. */
 #if PG_VERSION_NUM > 100000
@@ -29,20 +30,53 @@
 #define GetTupleDescAttr(tupdesc, i) ((tupdesc)->attrs[(i)])
 #endif
 
+#if PG_VERSION_NUM < 110000
+#define pq_sendint32(buf, i) pq_sendint((buf), (i), 4)
+#endif
+
 /* initial number of packages hashes */
 #define NUMPACKAGES 8
 #define NUMVARIABLES 16
 
+/* Storage of record tuples, see pg_variables_record.c */
+typedef struct RecordArena RecordArena;
+/* Ordered index of records and its scan, see pg_variables_record.c */
+typedef struct RecordIndex RecordIndex;
+typedef struct RecordIndexScan RecordIndexScan;
+typedef struct RecordHashIndex RecordHashIndex;
+/* Unpacked values of attributes of records, see pg_variables_record.c */
+typedef struct RecordColumns RecordColumns;
+
+/* Kinds of keys with specialized hash and match routines */
+typedef enum RecordKeyKind
+{
+	RECORD_KEY_GENERIC,			/* via the type's functions */
+	RECORD_KEY_INT4,
+	RECORD_KEY_INT8,
+	RECORD_KEY_TEXT,
+	RECORD_KEY_UUID
+} RecordKeyKind;
+
 typedef struct RecordVar
 {
 	HTAB	   *rhash;
 	TupleDesc	tupdesc;
 	/* Memory context for records hash table for easy memory release */
 	MemoryContext hctx;
+	/* Arena for record tuples, allocated within hctx */
+	RecordArena *arena;
+	/* Ordered index of records by the key if created, allocated within hctx */
+	RecordIndex *index;
+	/* Hash indexes of records by other attributes, allocated within hctx */
+	RecordHashIndex *hash_indexes;
+	/* Values of attributes unpacked by scans, allocated within hctx */
+	RecordColumns *columns;
 	/* Hash function info */
 	FmgrInfo	hash_proc;
 	/* Match function info */
 	FmgrInfo	cmp_proc;
+	/* Kind of the key, the functions above are used for generic keys */
+	RecordKeyKind key_kind;
 } RecordVar;
 
 typedef struct ScalarVar
@@ -86,6 +120,13 @@ typedef struct VarState
 		ScalarVar	scalar;
 		RecordVar	record;
 	}			value;
+
+	/*
+	 * Original versions of records changed within this state. If it is set,
+	 * the state shares its records with the previous state of the variable,
+	 * which can be restored by undoing these changes.
+	 */
+	HTAB	   *changes;
 } VarState;
 
 /* Transactional object */
@@ -118,6 +159,19 @@ typedef struct Package
 #ifdef PGPRO_EE
 	PackageContext *context;
 #endif
+	/* Start of the last statement which used the package */
+	TimestampTz last_used;
+
+	/*
+	 * Regular variables may be spilled to the spill file, then they are
+	 * loaded back on the next use of the package. See spillPackages().
+	 */
+	bool		is_spilled;
+	int			spill_fileno;
+	off_t		spill_offset;
+	int			spill_size;
+	int			spill_nvariables;
+	int64		spill_nrecords;
 } Package;
 
 /* Transactional variable */
@@ -145,12 +199,22 @@ typedef struct HashRecordKey
 {
 	Datum		value;
 	bool		is_null;
-	/* Hash function info */
-	FmgrInfo   *hash_proc;
-	/* Match function info */
-	FmgrInfo   *cmp_proc;
+	/* Hash of the value, computed once when the key is made */
+	uint32		hash;
 }			HashRecordKey;
 
+/*
+ * Key to search in records hash. Entries of the hash store only the key part,
+ * the match function info is taken from the searched key.
+ */
+typedef struct HashRecordSearchKey
+{
+	HashRecordKey key;
+	RecordKeyKind kind;
+	/* Match function info, used for generic keys */
+	FmgrInfo   *cmp_proc;
+}			HashRecordSearchKey;
+
 typedef struct HashRecordEntry
 {
 	HashRecordKey key;
@@ -175,26 +239,105 @@ typedef enum TransObjectType
 typedef struct ChangesStackNode
 {
 	dlist_node	node;
+	/* Transaction nesting level of the changes */
+	int			level;
 	dlist_head *changedVarsList;
 	dlist_head *changedPacksList;
 	MemoryContext ctx;
 }			ChangesStackNode;
 
+/* Counters of work done by the session, see pgv_perf_stats() */
+typedef struct PerfStats
+{
+	int64		variable_lookups;
+	int64		lookup_cache_hits;
+	int64		scalar_gets;
+	int64		scalar_sets;
+	int64		record_inserts;
+	int64		record_updates;
+	int64		record_deletes;
+	int64		records_returned;
+	int64		bytes_copied;
+	int64		savepoint_copies;
+	int64		records_saved;
+	int64		rehashes;
+} PerfStats;
+
 /* pg_variables.c */
 extern bool convert_unknownoid;
+extern bool track_perf_stats;
+extern int	compression_threshold;
+extern PerfStats perf_stats;
+
+/* Add n to the counter of perf_stats if counting is enabled */
+#define PERF_COUNT(counter, n) \
+	do { \
+		if (track_perf_stats) \
+			perf_stats.counter += (n); \
+	} while (0)
+
+extern void check_memory_limit(Size size);
+extern void release_memory(Size size);
+extern Datum compress_value(Datum value);
+extern void getKeyFromName(text *name, char *key);
+extern void dump_name(StringInfo buf, const char *name);
+extern void load_name(StringInfo buf, char *name);
 
-extern void init_record(RecordVar *record, TupleDesc tupdesc, Variable *variable);
+extern void init_record(RecordVar *record, TupleDesc tupdesc, Variable *variable,
+						long nrows);
 extern void check_attributes(Variable *variable, HeapTupleHeader *rec, TupleDesc tupdesc);
+extern bool is_unknownoid_in_tupdesc(TupleDesc tupdesc);
 extern void coerce_unknown_first_record(TupleDesc *tupdesc, HeapTupleHeader * rec);
 extern void check_record_key(Variable *variable, Oid typid);
 
+extern void init_record_key(RecordVar *record, Datum value, bool is_null,
+							HashRecordSearchKey *k);
+extern void init_record_key_procs(RecordVar *record, Oid keyid);
+extern bool match_record_key(HashRecordSearchKey *k, Datum value,
+							 bool is_null);
 extern void insert_record(Variable *variable, HeapTupleHeader tupleHeader);
 extern bool update_record(Variable *variable, HeapTupleHeader tupleHeader);
+extern bool upsert_record(Variable *variable, HeapTupleHeader tupleHeader);
 extern bool delete_record(Variable *variable, Datum value, bool is_null);
-extern void insert_record_copy(RecordVar *dest_record, Datum src_tuple,
-							   Variable *variable);
+extern void reserve_record(Variable *variable, long nrows);
+extern void truncate_record(Variable *variable);
+extern void dump_record(RecordVar *record, StringInfo buf);
+extern void load_record(Variable *variable, StringInfo buf, bool build);
+
+extern void create_record_index(RecordVar *record);
+extern RecordIndexScan *record_index_begin(RecordVar *record,
+										   Datum lo, bool has_lo,
+										   Datum hi, bool has_hi,
+										   bool skip_nulls);
+extern bool record_index_next(RecordIndexScan *scan, Datum *tuple);
+extern RecordIndexScan *record_index_begin_after(RecordVar *record,
+												 Datum last,
+												 bool last_is_null);
+extern bool record_index_last(RecordIndexScan *scan, Datum *value,
+							  bool *is_null);
+extern void create_record_hash_index(RecordVar *record, int attnum);
+extern int	select_record_by(RecordVar *record, int attnum, Datum value,
+							 bool is_null, Datum **tuples);
+extern long count_record_hash_collisions(RecordVar *record);
+extern long get_record_column(RecordVar *record, int attnum, Datum **values,
+							  bool **isnull);
+
+extern HTAB *make_record_changes(Variable *variable);
+extern void rollback_record_changes(RecordVar *record, HTAB *changes);
+extern void discard_record_changes(RecordVar *record, HTAB *changes);
+extern HTAB *merge_record_changes(RecordVar *record, HTAB *changes,
+								  HTAB *prev_changes);
 extern bool removeObject(TransObject *object, TransObjectType type);
 
+/* pg_variables_shared.c */
+extern void init_shared_variables(void);
+extern void share_record(text *package_name, text *var_name,
+						 RecordVar *record);
+extern bool unshare_record(text *package_name, text *var_name);
+extern bool select_shared_record(text *package_name, text *var_name,
+								 Oid value_type, Datum value, bool is_null,
+								 Datum *result, bool *found);
+
 #define GetActualState(object) \
 	(dlist_head_element(TransState, node, &((TransObject *) object)->states))
 
@@ -23,8 +23,14 @@
 #include "access/tuptoaster.h"
 #endif
 
+#if PG_VERSION_NUM >= 130000
+#include "common/hashfn.h"
+#else
+#include "access/hash.h"
+#endif
 #include "catalog/pg_collation.h"
 #include "catalog/pg_type.h"
+#include "libpq/pqformat.h"
 #include "parser/parse_type.h"
 #include "utils/builtins.h"
 #include "utils/datum.h"
@@ -32,65 +38,391 @@
 #include "utils/syscache.h"
 #include "utils/memutils.h"
 #include "utils/typcache.h"
+#include "utils/uuid.h"
 
 #include "pg_variables.h"
 
 /*
- * Hash function for records.
- *
- * We use the element type's default hash opclass, and the default collation
- * if the type is collation-sensitive.
+ * Get the specialized hash and match routines for keys of the type, which
+ * don't need fmgr calls. text keys are compared as strings of bytes, which
+ * gives the same equality as the default collation since it is deterministic.
  */
+static RecordKeyKind
+record_key_kind(Oid typid)
+{
+	switch (typid)
+	{
+		case INT4OID:
+			return RECORD_KEY_INT4;
+		case INT8OID:
+			return RECORD_KEY_INT8;
+		case TEXTOID:
+			return RECORD_KEY_TEXT;
+		case UUIDOID:
+			return RECORD_KEY_UUID;
+		default:
+			return RECORD_KEY_GENERIC;
+	}
+}
+
 static uint32
-record_hash(const void *key, Size keysize)
+text_key_hash(Datum value)
+{
+	text	   *t = DatumGetTextPP(value);
+	uint32		h;
+
+	h = DatumGetUInt32(hash_any((unsigned char *) VARDATA_ANY(t),
+								VARSIZE_ANY_EXHDR(t)));
+	if ((Pointer) t != DatumGetPointer(value))
+		pfree(t);
+
+	return h;
+}
+
+static int
+text_key_cmp(Datum value1, Datum value2)
 {
-	HashRecordKey k = *((const HashRecordKey *) key);
-	Datum		h;
+	text	   *t1 = DatumGetTextPP(value1);
+	text	   *t2 = DatumGetTextPP(value2);
+	Size		len1 = VARSIZE_ANY_EXHDR(t1),
+				len2 = VARSIZE_ANY_EXHDR(t2);
+	int			c;
+
+	/* Only equality matters in the hash */
+	if (len1 != len2)
+		c = len1 < len2 ? -1 : 1;
+	else
+		c = memcmp(VARDATA_ANY(t1), VARDATA_ANY(t2), len1);
+
+	if ((Pointer) t1 != DatumGetPointer(value1))
+		pfree(t1);
+	if ((Pointer) t2 != DatumGetPointer(value2))
+		pfree(t2);
+
+	return c;
+}
 
-	if (k.is_null)
+/*
+ * Compute the hash of a key value.
+ *
+ * Generic keys use the element type's default hash opclass, and the default
+ * collation if the type is collation-sensitive.
+ */
+static inline uint32
+record_key_hash(RecordKeyKind kind, FmgrInfo *hash_proc, Datum value,
+				bool is_null)
+{
+	if (is_null)
 		return 0;
 
-	h = FunctionCall1Coll(k.hash_proc, DEFAULT_COLLATION_OID, k.value);
-	return DatumGetUInt32(h);
+	switch (kind)
+	{
+		case RECORD_KEY_INT4:
+			return DatumGetUInt32(hash_uint32((uint32) DatumGetInt32(value)));
+		case RECORD_KEY_INT8:
+			{
+				int64		v = DatumGetInt64(value);
+				uint32		lohalf = (uint32) v;
+				uint32		hihalf = (uint32) (v >> 32);
+
+				return DatumGetUInt32(hash_uint32(lohalf ^ hihalf));
+			}
+		case RECORD_KEY_TEXT:
+			return text_key_hash(value);
+		case RECORD_KEY_UUID:
+			return DatumGetUInt32(hash_any(DatumGetUUIDP(value)->data,
+										   UUID_LEN));
+		default:
+			return DatumGetUInt32(FunctionCall1Coll(hash_proc,
+													DEFAULT_COLLATION_OID,
+													value));
+	}
+}
+
+/*
+ * Compare key values, NULLs are handled by the caller.
+ */
+static inline int
+record_key_cmp(RecordKeyKind kind, FmgrInfo *cmp_proc, Datum value1,
+			   Datum value2)
+{
+	switch (kind)
+	{
+		case RECORD_KEY_INT4:
+			{
+				int32		v1 = DatumGetInt32(value1),
+							v2 = DatumGetInt32(value2);
+
+				return v1 < v2 ? -1 : (v1 > v2 ? 1 : 0);
+			}
+		case RECORD_KEY_INT8:
+			{
+				int64		v1 = DatumGetInt64(value1),
+							v2 = DatumGetInt64(value2);
+
+				return v1 < v2 ? -1 : (v1 > v2 ? 1 : 0);
+			}
+		case RECORD_KEY_TEXT:
+			return text_key_cmp(value1, value2);
+		case RECORD_KEY_UUID:
+			return memcmp(DatumGetUUIDP(value1)->data,
+						  DatumGetUUIDP(value2)->data, UUID_LEN);
+		default:
+			return DatumGetInt32(FunctionCall2Coll(cmp_proc,
+												   DEFAULT_COLLATION_OID,
+												   value1, value2));
+	}
+}
+
+/*
+ * Make the key to search in the hash with the given function infos.
+ */
+static inline void
+init_search_key(HashRecordSearchKey *k, Datum value, bool is_null,
+				RecordKeyKind kind, FmgrInfo *hash_proc, FmgrInfo *cmp_proc)
+{
+	k->key.value = value;
+	k->key.is_null = is_null;
+	k->key.hash = record_key_hash(kind, hash_proc, value, is_null);
+	k->kind = kind;
+	k->cmp_proc = cmp_proc;
+}
+
+/*
+ * Make the key to search for the record by the key value.
+ */
+void
+init_record_key(RecordVar *record, Datum value, bool is_null,
+				HashRecordSearchKey *k)
+{
+	init_search_key(k, value, is_null, record->key_kind,
+					&record->hash_proc, &record->cmp_proc);
+}
+
+/*
+ * Hash function for records. The hash is computed when the key is made, so
+ * that keys of existing entries can be reused without calling the hash
+ * function again.
+ */
+static uint32
+record_hash(const void *key, Size keysize)
+{
+	return ((const HashRecordKey *) key)->hash;
 }
 
 /*
  * Matching function for records, to be used in hashtable lookups.
+ *
+ * dynahash passes the key of a hash entry as key1 and the searched key as
+ * key2. Entries don't store the match function info, it is taken from the
+ * searched key, which is always HashRecordSearchKey.
  */
 static int
 record_match(const void *key1, const void *key2, Size keysize)
 {
-	HashRecordKey k1 = *((const HashRecordKey *) key1);
-	HashRecordKey k2 = *((const HashRecordKey *) key2);
-	Datum		c;
+	const HashRecordKey *k1 = (const HashRecordKey *) key1;
+	const HashRecordSearchKey *k2 = (const HashRecordSearchKey *) key2;
 
-	if (k1.is_null)
+	if (k1->is_null)
 	{
-		if (k2.is_null)
+		if (k2->key.is_null)
 			return 0;			/* NULL "=" NULL */
 		else
 			return 1;			/* NULL ">" not-NULL */
 	}
-	else if (k2.is_null)
+	else if (k2->key.is_null)
 		return -1;				/* not-NULL "<" NULL */
 
-	c = FunctionCall2Coll(k1.cmp_proc, DEFAULT_COLLATION_OID,
-						  k1.value, k2.value);
-	return DatumGetInt32(c);
+	return record_key_cmp(k2->kind, k2->cmp_proc, k1->value, k2->key.value);
+}
+
+/*
+ * Check if the key value of a record matches the searched key, whose hash
+ * is known to be equal to the hash of the value.
+ */
+bool
+match_record_key(HashRecordSearchKey *k, Datum value, bool is_null)
+{
+	HashRecordKey key;
+
+	key.value = value;
+	key.is_null = is_null;
+	key.hash = k->key.hash;
+
+	return record_match(&key, k, sizeof(HashRecordKey)) == 0;
+}
+
+/*
+ * Record tuples are stored in the arena of the variable: small tuples are
+ * packed into blocks allocated within the records memory context, freed
+ * tuples are kept in free lists by their size to be reused. Blocks are
+ * released only with the whole memory context.
+ *
+ * Large tuples are allocated by palloc() as usual. The length of the stored
+ * tuple tells where it came from.
+ */
+#define ARENA_MAX_TUPLE_SIZE	1024
+#define ARENA_MIN_BLOCK_SIZE	ALLOCSET_SMALL_INITSIZE
+#define ARENA_MAX_BLOCK_SIZE	ALLOCSET_DEFAULT_INITSIZE
+
+#define ARENA_TUPLE(len)		(MAXALIGN(len) <= ARENA_MAX_TUPLE_SIZE)
+#define ARENA_LIST(size)		((size) / MAXIMUM_ALIGNOF - 1)
+
+struct RecordArena
+{
+	char	   *free_ptr;		/* free space of the current block */
+	char	   *end_ptr;		/* end of the current block */
+	Size		block_size;		/* size of the next block */
+	/* Lists of freed tuples, indexed by ARENA_LIST() of their size */
+	void	   *free_lists[ARENA_MAX_TUPLE_SIZE / MAXIMUM_ALIGNOF];
+};
+
+/*
+ * Create the arena in the memory context of records.
+ */
+static RecordArena *
+record_arena_create(MemoryContext hctx)
+{
+	RecordArena *arena;
+
+	arena = (RecordArena *) MemoryContextAllocZero(hctx, sizeof(RecordArena));
+	arena->block_size = ARENA_MIN_BLOCK_SIZE;
+
+	return arena;
+}
+
+/*
+ * Put a free piece of the arena into the free list of its size.
+ */
+static inline void
+record_arena_push(RecordArena *arena, void *ptr, Size size)
+{
+	Assert(size == MAXALIGN(size) && size <= ARENA_MAX_TUPLE_SIZE);
+
+	*((void **) ptr) = arena->free_lists[ARENA_LIST(size)];
+	arena->free_lists[ARENA_LIST(size)] = ptr;
+}
+
+/*
+ * Allocate memory for a tuple of the record variable.
+ */
+static void *
+record_alloc_tuple(RecordVar *record, Size len)
+{
+	RecordArena *arena = record->arena;
+	Size		size = MAXALIGN(len);
+	void	   *ptr;
+
+	if (!ARENA_TUPLE(len))
+		return MemoryContextAlloc(record->hctx, len);
+
+	/* Reuse a freed tuple of the same size */
+	ptr = arena->free_lists[ARENA_LIST(size)];
+	if (ptr != NULL)
+	{
+		arena->free_lists[ARENA_LIST(size)] = *((void **) ptr);
+		return ptr;
+	}
+
+	if (arena->free_ptr + size > arena->end_ptr)
+	{
+		Size		rest = arena->end_ptr - arena->free_ptr;
+
+		/* Keep the rest of the current block */
+		if (rest >= MAXIMUM_ALIGNOF)
+			record_arena_push(arena, arena->free_ptr, rest);
+
+		arena->free_ptr = MemoryContextAlloc(record->hctx, arena->block_size);
+		arena->end_ptr = arena->free_ptr + arena->block_size;
+		if (arena->block_size < ARENA_MAX_BLOCK_SIZE)
+			arena->block_size <<= 1;
+	}
+
+	ptr = arena->free_ptr;
+	arena->free_ptr += size;
+
+	return ptr;
 }
 
+/*
+ * Release a tuple of the record variable.
+ */
+static void
+record_free_tuple(RecordVar *record, Datum tuple)
+{
+	Size		len;
+
+	len = HeapTupleHeaderGetDatumLength((HeapTupleHeader) DatumGetPointer(tuple));
+	release_memory(len);
+	if (ARENA_TUPLE(len))
+		record_arena_push(record->arena, DatumGetPointer(tuple),
+						  MAXALIGN(len));
+	else
+		pfree(DatumGetPointer(tuple));
+}
+
+/*
+ * Get the initial block size of records memory context, which is big enough
+ * to store nrows records of average width.
+ */
+static Size
+record_init_block_size(TupleDesc tupdesc, long nrows)
+{
+	Size		width = SizeofHeapTupleHeader;
+	Size		size = ALLOCSET_DEFAULT_INITSIZE;
+	double		total;
+	int			i;
+
+	if (nrows <= 0)
+		return size;
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = GetTupleDescAttr(tupdesc, i);
+
+		width += get_typavgwidth(attr->atttypid, attr->atttypmod);
+	}
+
+	/* Count a chunk header of each record too */
+	total = (double) (MAXALIGN(width) + 2 * sizeof(void *)) * nrows;
+
+	while (size < total && size < ALLOCSET_DEFAULT_MAXSIZE)
+		size <<= 1;
+
+	return size;
+}
+
+/*
+ * Initialize the record collection of the variable by the structure of the
+ * first record. nrows is the expected number of records to presize the
+ * records hash, 0 means the default size.
+ */
 void
-init_record(RecordVar *record, TupleDesc tupdesc, Variable *variable)
+init_record(RecordVar *record, TupleDesc tupdesc, Variable *variable,
+			long nrows)
 {
 	HASHCTL		ctl;
 	char		hash_name[BUFSIZ];
 	MemoryContext oldcxt,
 				topctx;
+	Size		initBlockSize;
 	TypeCacheEntry *typentry;
 	Oid			keyid;
 
 	Assert(variable->typid == RECORDOID);
 
+	/*
+	 * If records are shared with the previous state of the variable, give
+	 * them back. The actual state gets its own records.
+	 */
+	if (((VarState *) GetActualState(variable))->changes)
+	{
+		VarState   *state = (VarState *) GetActualState(variable);
+
+		rollback_record_changes(record, state->changes);
+		state->changes = NULL;
+	}
+
 	/* First get hash and match functions for key type. */
 	keyid = GetTupleDescAttr(tupdesc, 0)->atttypid;
 	typentry = lookup_type_cache(keyid,
@@ -129,27 +461,33 @@ init_record(RecordVar *record, TupleDesc tupdesc, Variable *variable)
 		variable->package->hctxTransact :
 		variable->package->hctxRegular;
 
+	initBlockSize = record_init_block_size(tupdesc, nrows);
+
 #if PG_VERSION_NUM >= 120000
 	record->hctx = AllocSetContextCreateInternal(topctx,
 												 hash_name,
 												 ALLOCSET_DEFAULT_MINSIZE,
-												 ALLOCSET_DEFAULT_INITSIZE,
+												 initBlockSize,
 												 ALLOCSET_DEFAULT_MAXSIZE);
 #elif PG_VERSION_NUM >= 110000
 	record->hctx = AllocSetContextCreateExtended(topctx,
 												 hash_name,
 												 ALLOCSET_DEFAULT_MINSIZE,
-												 ALLOCSET_DEFAULT_INITSIZE,
+												 initBlockSize,
 												 ALLOCSET_DEFAULT_MAXSIZE);
 #else
 	record->hctx = AllocSetContextCreate(topctx,
 										 hash_name,
 										 ALLOCSET_DEFAULT_MINSIZE,
-										 ALLOCSET_DEFAULT_INITSIZE,
+										 initBlockSize,
 										 ALLOCSET_DEFAULT_MAXSIZE);
 #endif
 
 	oldcxt = MemoryContextSwitchTo(record->hctx);
+	record->arena = record_arena_create(record->hctx);
+	record->index = NULL;
+	record->hash_indexes = NULL;
+	record->columns = NULL;
 	record->tupdesc = CreateTupleDescCopy(tupdesc);
 #if PG_VERSION_NUM < 120000
 	record->tupdesc->tdhasoid = false;
@@ -165,18 +503,38 @@ init_record(RecordVar *record, TupleDesc tupdesc, Variable *variable)
 	ctl.hash = record_hash;
 	ctl.match = record_match;
 
-	record->rhash = hash_create(hash_name, NUMVARIABLES, &ctl,
+	record->rhash = hash_create(hash_name, Max(nrows, NUMVARIABLES), &ctl,
 								HASH_ELEM | HASH_CONTEXT |
 								HASH_FUNCTION | HASH_COMPARE);
 
-	fmgr_info(typentry->hash_proc_finfo.fn_oid, &record->hash_proc);
-	fmgr_info(typentry->cmp_proc_finfo.fn_oid, &record->cmp_proc);
+	init_record_key_procs(record, keyid);
 
 	MemoryContextSwitchTo(oldcxt);
 }
 
+/*
+ * Initialize hash and match functions of the record collection for keys of
+ * the type, the caller checks that they exist. Function infos are allocated
+ * in the current memory context.
+ */
+void
+init_record_key_procs(RecordVar *record, Oid keyid)
+{
+	TypeCacheEntry *typentry;
+
+	typentry = lookup_type_cache(keyid,
+								 TYPECACHE_HASH_PROC_FINFO |
+								 TYPECACHE_CMP_PROC_FINFO);
+	Assert(OidIsValid(typentry->hash_proc_finfo.fn_oid) &&
+		   OidIsValid(typentry->cmp_proc_finfo.fn_oid));
+
+	fmgr_info(typentry->hash_proc_finfo.fn_oid, &record->hash_proc);
+	fmgr_info(typentry->cmp_proc_finfo.fn_oid, &record->cmp_proc);
+	record->key_kind = record_key_kind(keyid);
+}
+
 /* Check if any attributes of type UNKNOWNOID are in given tupdesc */
-static int
+bool
 is_unknownoid_in_tupdesc(TupleDesc tupdesc)
 {
 	int 	i = 0;
@@ -348,37 +706,144 @@ check_record_key(Variable *variable, Oid typid)
 						"key type", GetName(variable))));
 }
 
+/*
+ * Form a copy of the tuple with its wide attributes compressed, see
+ * compress_value(). The key attribute is never compressed to hash it as is.
+ * Returns NULL if there is nothing to compress.
+ */
+static HeapTuple
+compress_record_tuple(RecordVar *record, HeapTupleHeader tupleHeader)
+{
+	TupleDesc	tupdesc = record->tupdesc;
+	HeapTupleData tuple;
+	HeapTuple	result = NULL;
+	Datum	   *values;
+	bool	   *isnull;
+	bool	   *compressed;
+	bool		any = false;
+	int			i;
+
+	if (compression_threshold == 0 ||
+		HeapTupleHeaderGetDatumLength(tupleHeader) <= compression_threshold)
+		return NULL;
+
+	tuple.t_len = HeapTupleHeaderGetDatumLength(tupleHeader);
+	ItemPointerSetInvalid(&(tuple.t_self));
+	tuple.t_tableOid = InvalidOid;
+	tuple.t_data = tupleHeader;
+
+	values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	isnull = (bool *) palloc(tupdesc->natts * sizeof(bool));
+	compressed = (bool *) palloc0(tupdesc->natts * sizeof(bool));
+	heap_deform_tuple(&tuple, tupdesc, values, isnull);
+
+	for (i = 1; i < tupdesc->natts; i++)
+	{
+		Datum		value;
+
+		if (isnull[i] || GetTupleDescAttr(tupdesc, i)->attlen != -1)
+			continue;
+
+		value = compress_value(values[i]);
+		if (value != (Datum) 0)
+		{
+			values[i] = value;
+			compressed[i] = true;
+			any = true;
+		}
+	}
+
+	if (any)
+	{
+		result = heap_form_tuple(tupdesc, values, isnull);
+		for (i = 1; i < tupdesc->natts; i++)
+			if (compressed[i])
+				pfree(DatumGetPointer(values[i]));
+	}
+
+	pfree(values);
+	pfree(isnull);
+	pfree(compressed);
+
+	return result;
+}
+
 static Datum
 copy_record_tuple(RecordVar *record, HeapTupleHeader tupleHeader)
 {
 	TupleDesc	tupdesc;
 	HeapTupleHeader result;
+	HeapTuple	compressed;
+	int			len = HeapTupleHeaderGetDatumLength(tupleHeader);
 	int			tuple_len;
 
 	tupdesc = record->tupdesc;
 
+	/*
+	 * External values are counted by their pointers, the estimate is corrected
+	 * by the length of the stored tuple below.
+	 */
+	check_memory_limit(len);
+
 	/*
 	 * If the tuple contains any external TOAST pointers, we have to inline
 	 * those fields to meet the conventions for composite-type Datums.
 	 */
 	if (HeapTupleHeaderHasExternal(tupleHeader))
-		return toast_flatten_tuple_to_datum(tupleHeader,
+	{
+		Datum		flat;
+
+		flat = toast_flatten_tuple_to_datum(tupleHeader,
 											HeapTupleHeaderGetDatumLength(tupleHeader),
 											tupdesc);
+		compressed = compress_record_tuple(record,
+										   (HeapTupleHeader) DatumGetPointer(flat));
+		if (compressed)
+		{
+			pfree(DatumGetPointer(flat));
+			flat = heap_copy_tuple_as_datum(compressed, tupdesc);
+			heap_freetuple(compressed);
+		}
+		tuple_len = HeapTupleHeaderGetDatumLength((HeapTupleHeader) DatumGetPointer(flat));
+		PERF_COUNT(bytes_copied, tuple_len);
+		if (tuple_len > len)
+			check_memory_limit(tuple_len - len);
+		else
+			release_memory(len - tuple_len);
+		if (!ARENA_TUPLE(tuple_len))
+			return flat;
+
+		/* Move a small tuple into the arena */
+		result = (HeapTupleHeader) record_alloc_tuple(record, tuple_len);
+		memcpy((char *) result, DatumGetPointer(flat), tuple_len);
+		pfree(DatumGetPointer(flat));
+
+		return PointerGetDatum(result);
+	}
 
 	/*
-	 * Fast path for easy case: just make a palloc'd copy and insert the
-	 * correct composite-Datum header fields (since those may not be set if
-	 * the given tuple came from disk, rather than from heap_form_tuple).
+	 * Fast path for easy case: just make a copy and insert the correct
+	 * composite-Datum header fields (since those may not be set if the given
+	 * tuple came from disk, rather than from heap_form_tuple).
 	 */
+	compressed = compress_record_tuple(record, tupleHeader);
+	if (compressed)
+		tupleHeader = compressed->t_data;
+
 	tuple_len = HeapTupleHeaderGetDatumLength(tupleHeader);
-	result = (HeapTupleHeader) palloc(tuple_len);
+	PERF_COUNT(bytes_copied, tuple_len);
+	if (tuple_len < len)
+		release_memory(len - tuple_len);
+	result = (HeapTupleHeader) record_alloc_tuple(record, tuple_len);
 	memcpy((char *) result, (char *) tupleHeader, tuple_len);
 
 	HeapTupleHeaderSetDatumLength(result, tuple_len);
 	HeapTupleHeaderSetTypeId(result, tupdesc->tdtypeid);
 	HeapTupleHeaderSetTypMod(result, tupdesc->tdtypmod);
 
+	if (compressed)
+		heap_freetuple(compressed);
+
 	return PointerGetDatum(result);
 }
 
@@ -414,104 +879,1070 @@ get_record_key(Datum tuple, TupleDesc tupdesc, bool *isnull)
 }
 
 /*
- * Insert a new record. New record key should be unique in the variable.
+ * Ordered index of records is a skip list over the tuples of the records
+ * hash. It is built on request and then maintained together with the hash.
+ * Keys are compared by the btree comparison function of the key type, NULL
+ * key goes last.
  */
-void
-insert_record(Variable *variable, HeapTupleHeader tupleHeader)
+#define INDEX_MAX_HEIGHT	24
+
+typedef struct IndexNode
 {
 	Datum		tuple;
-	Datum		value;
-	bool		isnull;
-	RecordVar  *record;
-	HashRecordKey k;
-	HashRecordEntry *item;
-	bool		found;
-	MemoryContext oldcxt;
+	Datum		value;			/* key of the record, points into the tuple */
+	bool		is_null;
+	int			height;
+	struct IndexNode *next[FLEXIBLE_ARRAY_MEMBER];
+} IndexNode;
 
-	Assert(variable->typid == RECORDOID);
-
-	record = &(GetActualValue(variable).record);
+#define IndexNodeSize(height) \
+	(offsetof(IndexNode, next) + (height) * sizeof(IndexNode *))
 
-	oldcxt = MemoryContextSwitchTo(record->hctx);
+struct RecordIndex
+{
+	MemoryContext mcxt;			/* records memory context */
+	IndexNode  *head;			/* head node of INDEX_MAX_HEIGHT */
+	int			height;			/* current height of the list */
+	uint32		seed;			/* state of the random height generator */
+	/* Incremented when a node is added or removed */
+	uint64		generation;
+	/* Comparison function info */
+	FmgrInfo	cmp_proc;
+	bool		keybyval;
+	int16		keylen;
+};
+
+struct RecordIndexScan
+{
+	RecordIndex *index;
+	MemoryContext mcxt;			/* memory context of the scan */
+	IndexNode  *next;			/* node to be returned next */
+	uint64		generation;		/* generation of the index for next */
+	/* Copy of the last returned key to continue after the index changed */
+	Datum		last;
+	bool		last_is_null;
+	bool		has_last;
+	/* Bounds of the range */
+	Datum		lo;
+	bool		has_lo;
+	Datum		hi;
+	bool		has_hi;
+	bool		skip_nulls;
+};
 
-	tuple = copy_record_tuple(record, tupleHeader);
+static int
+index_compare(RecordIndex *index, Datum value1, bool is_null1,
+			  Datum value2, bool is_null2)
+{
+	if (is_null1)
+		return is_null2 ? 0 : 1;
+	else if (is_null2)
+		return -1;
+
+	return DatumGetInt32(FunctionCall2Coll(&index->cmp_proc,
+										   DEFAULT_COLLATION_OID,
+										   value1, value2));
+}
 
-	/* Inserting a new record */
-	value = get_record_key(tuple, record->tupdesc, &isnull);
-	/* First, check if there is a record with same key */
-	k.value = value;
-	k.is_null = isnull;
-	k.hash_proc = &record->hash_proc;
-	k.cmp_proc = &record->cmp_proc;
+/*
+ * Find the first node with the key greater than (or equal to, if inclusive
+ * is true) the given one. If update isn't NULL it gets the last nodes before
+ * it at every level.
+ */
+static IndexNode *
+index_seek(RecordIndex *index, Datum value, bool is_null, bool inclusive,
+		   IndexNode **update)
+{
+	IndexNode  *node = index->head;
+	int			i;
 
-	item = (HashRecordEntry *) hash_search(record->rhash, &k,
-										   HASH_ENTER, &found);
-	if (found)
+	for (i = index->height - 1; i >= 0; i--)
 	{
-		pfree(DatumGetPointer(tuple));
-		MemoryContextSwitchTo(oldcxt);
-		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("there is a record in the variable \"%s\" with same "
-						"key", GetName(variable))));
+		IndexNode  *next;
+
+		while ((next = node->next[i]) != NULL)
+		{
+			int			c = index_compare(index, next->value, next->is_null,
+										  value, is_null);
+
+			if (c > 0 || (c == 0 && inclusive))
+				break;
+			node = next;
+		}
+		if (update)
+			update[i] = node;
 	}
-	/* Second, insert a new record */
-	item->tuple = tuple;
 
-	MemoryContextSwitchTo(oldcxt);
+	return node->next[0];
 }
 
 /*
- * Insert a record. New record key should be unique in the variable.
+ * Get a random height of a new node: every next level has a quarter of nodes
+ * of the previous one.
  */
-bool
-update_record(Variable *variable, HeapTupleHeader tupleHeader)
+static int
+index_random_height(RecordIndex *index)
 {
-	Datum		tuple;
-	Datum		value;
-	bool		isnull;
-	RecordVar  *record;
-	HashRecordKey k;
-	HashRecordEntry *item;
-	bool		found;
-	MemoryContext oldcxt;
-
-	Assert(variable->typid == RECORDOID);
+	int			height = 1;
 
-	record = &(GetActualValue(variable).record);
+	while (height < INDEX_MAX_HEIGHT)
+	{
+		uint32		x = index->seed;
 
-	oldcxt = MemoryContextSwitchTo(record->hctx);
+		/* xorshift32 */
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		index->seed = x;
 
-	tuple = copy_record_tuple(record, tupleHeader);
+		if ((x & 3) != 0)
+			break;
+		height++;
+	}
 
-	/* Update a record */
-	value = get_record_key(tuple, record->tupdesc, &isnull);
-	k.value = value;
-	k.is_null = isnull;
-	k.hash_proc = &record->hash_proc;
-	k.cmp_proc = &record->cmp_proc;
+	return height;
+}
 
-	item = (HashRecordEntry *) hash_search(record->rhash, &k,
-										   HASH_FIND, &found);
-	if (!found)
-	{
-		pfree(DatumGetPointer(tuple));
+/*
+ * Add the record into the index, or point the existing node to its new tuple.
+ */
+static void
+index_set(RecordIndex *index, HashRecordEntry *item)
+{
+	IndexNode  *update[INDEX_MAX_HEIGHT];
+	IndexNode  *node;
+	int			height,
+				i;
+
+	node = index_seek(index, item->key.value, item->key.is_null, true, update);
+	if (node != NULL &&
+		index_compare(index, node->value, node->is_null,
+					  item->key.value, item->key.is_null) == 0)
+	{
+		node->tuple = item->tuple;
+		node->value = item->key.value;
+		return;
+	}
+
+	height = index_random_height(index);
+	if (height > index->height)
+	{
+		for (i = index->height; i < height; i++)
+			update[i] = index->head;
+		index->height = height;
+	}
+
+	node = (IndexNode *) MemoryContextAlloc(index->mcxt, IndexNodeSize(height));
+	node->tuple = item->tuple;
+	node->value = item->key.value;
+	node->is_null = item->key.is_null;
+	node->height = height;
+	for (i = 0; i < height; i++)
+	{
+		node->next[i] = update[i]->next[i];
+		update[i]->next[i] = node;
+	}
+
+	index->generation++;
+}
+
+/*
+ * Remove the record with the given key from the index. It should be done
+ * before the tuple of the record is released.
+ */
+static void
+index_remove(RecordIndex *index, Datum value, bool is_null)
+{
+	IndexNode  *update[INDEX_MAX_HEIGHT];
+	IndexNode  *node;
+	int			i;
+
+	node = index_seek(index, value, is_null, true, update);
+	if (node == NULL ||
+		index_compare(index, node->value, node->is_null, value, is_null) != 0)
+		return;
+
+	for (i = 0; i < node->height; i++)
+		update[i]->next[i] = node->next[i];
+	pfree(node);
+
+	while (index->height > 1 && index->head->next[index->height - 1] == NULL)
+		index->height--;
+
+	index->generation++;
+}
+
+/*
+ * Build the ordered index of the record variable if it doesn't exist yet.
+ */
+void
+create_record_index(RecordVar *record)
+{
+	RecordIndex *index;
+	Form_pg_attribute attr;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+
+	if (record->index != NULL)
+		return;
+
+	attr = GetTupleDescAttr(record->tupdesc, 0);
+
+	index = (RecordIndex *) MemoryContextAlloc(record->hctx,
+											   sizeof(RecordIndex));
+	index->mcxt = record->hctx;
+	index->head = (IndexNode *)
+		MemoryContextAllocZero(record->hctx, IndexNodeSize(INDEX_MAX_HEIGHT));
+	index->head->height = INDEX_MAX_HEIGHT;
+	index->height = 1;
+	index->seed = 0x9E3779B9;
+	index->generation = 0;
+	fmgr_info_copy(&index->cmp_proc, &record->cmp_proc, record->hctx);
+	index->keybyval = attr->attbyval;
+	index->keylen = attr->attlen;
+
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+		index_set(index, item);
+
+	record->index = index;
+}
+
+/*
+ * Find the first node of the scan.
+ */
+static IndexNode *
+index_scan_first(RecordIndexScan *scan)
+{
+	if (scan->has_lo)
+		return index_seek(scan->index, scan->lo, false, true, NULL);
+	return scan->index->head->next[0];
+}
+
+/*
+ * Start an ordered scan of records of the variable, which should have the
+ * index. Records are returned from lo to hi inclusively, if the bounds are
+ * given. Bounds are copied into the current memory context, which should
+ * live as long as the scan.
+ */
+RecordIndexScan *
+record_index_begin(RecordVar *record, Datum lo, bool has_lo,
+				   Datum hi, bool has_hi, bool skip_nulls)
+{
+	RecordIndex *index = record->index;
+	RecordIndexScan *scan;
+
+	Assert(index != NULL);
+
+	scan = (RecordIndexScan *) palloc0(sizeof(RecordIndexScan));
+	scan->index = index;
+	scan->mcxt = CurrentMemoryContext;
+	scan->has_lo = has_lo;
+	if (has_lo)
+		scan->lo = datumCopy(lo, index->keybyval, index->keylen);
+	scan->has_hi = has_hi;
+	if (has_hi)
+		scan->hi = datumCopy(hi, index->keybyval, index->keylen);
+	scan->skip_nulls = skip_nulls;
+
+	scan->next = index_scan_first(scan);
+	scan->generation = index->generation;
+
+	return scan;
+}
+
+/*
+ * Get the next tuple of the ordered scan. Returns false when the scan is
+ * finished.
+ *
+ * Records may be added or removed between calls. Then the scan continues from
+ * the first key after the last returned one.
+ */
+bool
+record_index_next(RecordIndexScan *scan, Datum *tuple)
+{
+	RecordIndex *index = scan->index;
+	IndexNode  *node;
+
+	if (scan->generation != index->generation)
+	{
+		if (scan->has_last)
+			node = index_seek(index, scan->last, scan->last_is_null, false,
+							  NULL);
+		else
+			node = index_scan_first(scan);
+		scan->generation = index->generation;
+	}
+	else
+		node = scan->next;
+
+	if (node == NULL)
+		return false;
+	if (node->is_null && scan->skip_nulls)
+		return false;
+	if (scan->has_hi &&
+		index_compare(index, node->value, node->is_null, scan->hi, false) > 0)
+		return false;
+
+	if (scan->has_last && !scan->last_is_null && !index->keybyval)
+		pfree(DatumGetPointer(scan->last));
+	scan->last_is_null = node->is_null;
+	if (node->is_null)
+		scan->last = (Datum) 0;
+	else
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(scan->mcxt);
+
+		scan->last = datumCopy(node->value, index->keybyval, index->keylen);
+		MemoryContextSwitchTo(oldcxt);
+	}
+	scan->has_last = true;
+
+	scan->next = node->next[0];
+	*tuple = node->tuple;
+
+	return true;
+}
+
+/*
+ * Start an ordered scan of records with keys greater than the given one, NULL
+ * key is the greatest one. It continues a scan whose last returned key was
+ * saved by the caller, see record_index_last().
+ */
+RecordIndexScan *
+record_index_begin_after(RecordVar *record, Datum last, bool last_is_null)
+{
+	RecordIndex *index = record->index;
+	RecordIndexScan *scan;
+
+	Assert(index != NULL);
+
+	scan = (RecordIndexScan *) palloc0(sizeof(RecordIndexScan));
+	scan->index = index;
+	scan->mcxt = CurrentMemoryContext;
+	scan->last_is_null = last_is_null;
+	if (!last_is_null)
+		scan->last = datumCopy(last, index->keybyval, index->keylen);
+	scan->has_last = true;
+
+	scan->next = index_seek(index, scan->last, last_is_null, false, NULL);
+	scan->generation = index->generation;
+
+	return scan;
+}
+
+/*
+ * Get the last key returned by the ordered scan. Returns false if the scan
+ * hasn't returned records. The key is valid until the next call of
+ * record_index_next().
+ */
+bool
+record_index_last(RecordIndexScan *scan, Datum *value, bool *is_null)
+{
+	if (!scan->has_last)
+		return false;
+
+	*value = scan->last;
+	*is_null = scan->last_is_null;
+	return true;
+}
+
+/*
+ * Hash indexes of records by non-key attributes. Values of the attribute
+ * aren't unique, so every entry of the index hash refers to all records with
+ * the value.
+ */
+struct RecordHashIndex
+{
+	int			attnum;			/* attribute number, starting from 0 */
+	RecordKeyKind kind;
+	HTAB	   *hash;
+	/* Hash function info */
+	FmgrInfo	hash_proc;
+	/* Match function info */
+	FmgrInfo	cmp_proc;
+	bool		attbyval;
+	int16		attlen;
+	struct RecordHashIndex *next;
+};
+
+typedef struct HashIndexEntry
+{
+	HashRecordKey key;			/* copy of the attribute value */
+	int			nitems;
+	int			maxitems;
+	HashRecordEntry **items;	/* entries of records hash */
+}			HashIndexEntry;
+
+/*
+ * Get the value of the attribute of the record tuple.
+ */
+static Datum
+get_record_attr(Datum tuple, TupleDesc tupdesc, int attnum, bool *isnull)
+{
+	HeapTupleData tup;
+
+	tup.t_len = HeapTupleHeaderGetDatumLength((HeapTupleHeader) DatumGetPointer(tuple));
+	ItemPointerSetInvalid(&(tup.t_self));
+	tup.t_tableOid = InvalidOid;
+	tup.t_data = (HeapTupleHeader) DatumGetPointer(tuple);
+
+	return heap_getattr(&tup, attnum + 1, tupdesc, isnull);
+}
+
+/*
+ * Add the record into the hash index.
+ */
+static void
+hash_index_add(RecordVar *record, RecordHashIndex *hindex,
+			   HashRecordEntry *item)
+{
+	HashRecordSearchKey k;
+	HashIndexEntry *entry;
+	Datum		value;
+	bool		is_null;
+	bool		found;
+
+	value = get_record_attr(item->tuple, record->tupdesc, hindex->attnum,
+							&is_null);
+	init_search_key(&k, value, is_null, hindex->kind,
+					&hindex->hash_proc, &hindex->cmp_proc);
+
+	entry = (HashIndexEntry *) hash_search(hindex->hash, &k, HASH_ENTER,
+										   &found);
+	if (!found)
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(record->hctx);
+
+		if (!is_null)
+			entry->key.value = datumCopy(value, hindex->attbyval,
+										 hindex->attlen);
+		MemoryContextSwitchTo(oldcxt);
+
+		entry->nitems = 0;
+		entry->maxitems = 1;
+		entry->items = (HashRecordEntry **)
+			MemoryContextAlloc(record->hctx, sizeof(HashRecordEntry *));
+	}
+	else if (entry->nitems == entry->maxitems)
+	{
+		entry->maxitems *= 2;
+		entry->items = (HashRecordEntry **)
+			repalloc(entry->items, entry->maxitems * sizeof(HashRecordEntry *));
+	}
+
+	entry->items[entry->nitems++] = item;
+}
+
+/*
+ * Remove the record from the hash index. It should be done before the tuple
+ * of the record is changed or released.
+ */
+static void
+hash_index_remove(RecordVar *record, RecordHashIndex *hindex,
+				  HashRecordEntry *item)
+{
+	HashRecordSearchKey k;
+	HashIndexEntry *entry;
+	Datum		value;
+	bool		is_null;
+	bool		found;
+	int			i;
+
+	value = get_record_attr(item->tuple, record->tupdesc, hindex->attnum,
+							&is_null);
+	init_search_key(&k, value, is_null, hindex->kind,
+					&hindex->hash_proc, &hindex->cmp_proc);
+
+	entry = (HashIndexEntry *) hash_search(hindex->hash, &k, HASH_FIND,
+										   &found);
+	if (!found)
+		return;
+
+	for (i = 0; i < entry->nitems; i++)
+	{
+		if (entry->items[i] == item)
+		{
+			entry->items[i] = entry->items[--entry->nitems];
+			break;
+		}
+	}
+
+	if (entry->nitems == 0)
+	{
+		/* The removed entry is valid until the next insertion */
+		hash_search(hindex->hash, &k, HASH_REMOVE, NULL);
+		pfree(entry->items);
+		if (!entry->key.is_null && !hindex->attbyval)
+			pfree(DatumGetPointer(entry->key.value));
+	}
+}
+
+/*
+ * Unpacked values of attributes of records, so that scans of an attribute
+ * don't deform every tuple. An attribute is unpacked on its first scan, and
+ * all of them are thrown away on any change of records. Values passed by
+ * reference point into the stored tuples.
+ *
+ * States of the variable which share records share the columns too, so the
+ * validity flag is kept here rather than in RecordVar.
+ */
+typedef struct RecordColumn
+{
+	int			attnum;			/* attribute number, starting from 0 */
+	Datum	   *values;
+	bool	   *isnull;			/* NULL if there are no null values */
+	struct RecordColumn *next;
+} RecordColumn;
+
+struct RecordColumns
+{
+	bool		valid;			/* records weren't changed since unpacking */
+	long		nrecords;
+	RecordColumn *columns;
+};
+
+/*
+ * Throw away the unpacked columns, records are going to be changed.
+ */
+static inline void
+record_columns_invalidate(RecordVar *record)
+{
+	if (record->columns)
+		record->columns->valid = false;
+}
+
+/*
+ * Add the record into all indexes of the variable.
+ */
+static void
+record_indexes_add(RecordVar *record, HashRecordEntry *item)
+{
+	RecordHashIndex *hindex;
+
+	record_columns_invalidate(record);
+	if (record->index)
+		index_set(record->index, item);
+	for (hindex = record->hash_indexes; hindex; hindex = hindex->next)
+		hash_index_add(record, hindex, item);
+}
+
+/*
+ * Remove the record from hash indexes of the variable, before its tuple is
+ * changed or released.
+ */
+static void
+record_hash_indexes_remove(RecordVar *record, HashRecordEntry *item)
+{
+	RecordHashIndex *hindex;
+
+	record_columns_invalidate(record);
+	for (hindex = record->hash_indexes; hindex; hindex = hindex->next)
+		hash_index_remove(record, hindex, item);
+}
+
+/*
+ * Remove the record from all indexes of the variable, before its tuple is
+ * released.
+ */
+static void
+record_indexes_remove(RecordVar *record, HashRecordEntry *item)
+{
+	if (record->index)
+		index_remove(record->index, item->key.value, item->key.is_null);
+	record_hash_indexes_remove(record, item);
+}
+
+/*
+ * Build the hash index of the record variable by the attribute if it doesn't
+ * exist yet. attnum starts from 0 and shouldn't be the key attribute.
+ */
+void
+create_record_hash_index(RecordVar *record, int attnum)
+{
+	RecordHashIndex *hindex;
+	Form_pg_attribute attr;
+	TypeCacheEntry *typentry;
+	HASHCTL		ctl;
+	char		hash_name[BUFSIZ];
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+
+	Assert(attnum > 0 && attnum < record->tupdesc->natts);
+
+	for (hindex = record->hash_indexes; hindex; hindex = hindex->next)
+	{
+		if (hindex->attnum == attnum)
+			return;
+	}
+
+	attr = GetTupleDescAttr(record->tupdesc, attnum);
+	typentry = lookup_type_cache(attr->atttypid,
+								 TYPECACHE_HASH_PROC_FINFO |
+								 TYPECACHE_CMP_PROC_FINFO);
+
+	if (!OidIsValid(typentry->hash_proc_finfo.fn_oid))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_FUNCTION),
+				 errmsg("could not identify a hash function for type %s",
+						format_type_be(attr->atttypid))));
+
+	if (!OidIsValid(typentry->cmp_proc_finfo.fn_oid))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_FUNCTION),
+				 errmsg("could not identify a matching function for type %s",
+						format_type_be(attr->atttypid))));
+
+	hindex = (RecordHashIndex *) MemoryContextAlloc(record->hctx,
+													sizeof(RecordHashIndex));
+	hindex->attnum = attnum;
+	hindex->kind = record_key_kind(attr->atttypid);
+	hindex->attbyval = attr->attbyval;
+	hindex->attlen = attr->attlen;
+	fmgr_info_cxt(typentry->hash_proc_finfo.fn_oid, &hindex->hash_proc,
+				  record->hctx);
+	fmgr_info_cxt(typentry->cmp_proc_finfo.fn_oid, &hindex->cmp_proc,
+				  record->hctx);
+
+	snprintf(hash_name, BUFSIZ, "Index hash for attribute %d", attnum + 1);
+
+	ctl.keysize = sizeof(HashRecordKey);
+	ctl.entrysize = sizeof(HashIndexEntry);
+	ctl.hcxt = record->hctx;
+	ctl.hash = record_hash;
+	ctl.match = record_match;
+
+	hindex->hash = hash_create(hash_name,
+							   Max(hash_get_num_entries(record->rhash),
+								   NUMVARIABLES),
+							   &ctl,
+							   HASH_ELEM | HASH_CONTEXT |
+							   HASH_FUNCTION | HASH_COMPARE);
+
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+		hash_index_add(record, hindex, item);
+
+	hindex->next = record->hash_indexes;
+	record->hash_indexes = hindex;
+}
+
+/*
+ * Find records of the variable by the value of the attribute. attnum starts
+ * from 0. Returns the number of found records and the array of their tuples,
+ * allocated within the current memory context, or -1 if there is no hash index
+ * by the attribute. Tuples aren't copied.
+ */
+int
+select_record_by(RecordVar *record, int attnum, Datum value, bool is_null,
+				 Datum **tuples)
+{
+	RecordHashIndex *hindex;
+	HashRecordSearchKey k;
+	HashIndexEntry *entry;
+	bool		found;
+	int			i;
+
+	for (hindex = record->hash_indexes; hindex; hindex = hindex->next)
+	{
+		if (hindex->attnum == attnum)
+			break;
+	}
+	if (hindex == NULL)
+		return -1;
+
+	init_search_key(&k, value, is_null, hindex->kind,
+					&hindex->hash_proc, &hindex->cmp_proc);
+
+	entry = (HashIndexEntry *) hash_search(hindex->hash, &k, HASH_FIND,
+										   &found);
+	if (!found)
+	{
+		*tuples = NULL;
+		return 0;
+	}
+
+	*tuples = (Datum *) palloc(entry->nitems * sizeof(Datum));
+	for (i = 0; i < entry->nitems; i++)
+		(*tuples)[i] = entry->items[i]->tuple;
+
+	return entry->nitems;
+}
+
+static int
+hash_value_cmp(const void *a, const void *b)
+{
+	uint32		ha = *(const uint32 *) a;
+	uint32		hb = *(const uint32 *) b;
+
+	return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+
+/*
+ * Count records whose key has the same hash value as the key of another
+ * record. The hash values are kept in entries, so keys aren't hashed again.
+ */
+long
+count_record_hash_collisions(RecordVar *record)
+{
+	long		nrecords = hash_get_num_entries(record->rhash);
+	long		ncollisions = 0;
+	uint32	   *hashes;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+	long		i = 0;
+
+	if (nrecords < 2)
+		return 0;
+
+	hashes = (uint32 *) MemoryContextAllocHuge(CurrentMemoryContext,
+											   nrecords * sizeof(uint32));
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+		hashes[i++] = item->key.hash;
+
+	qsort(hashes, nrecords, sizeof(uint32), hash_value_cmp);
+	for (i = 1; i < nrecords; i++)
+		ncollisions += hashes[i] == hashes[i - 1];
+
+	pfree(hashes);
+
+	return ncollisions;
+}
+
+/*
+ * Get values of the attribute of all records, unpacking them if they weren't
+ * unpacked since the last change of records. attnum starts from 0. isnull is
+ * set to NULL if there are no null values. Returns the number of records.
+ *
+ * Arrays are valid until records are changed.
+ */
+long
+get_record_column(RecordVar *record, int attnum, Datum **values, bool **isnull)
+{
+	RecordColumns *columns = record->columns;
+	RecordColumn *column;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+	bool		hasnulls = false;
+	long		i = 0;
+
+	Assert(attnum >= 0 && attnum < record->tupdesc->natts);
+
+	if (columns == NULL)
+	{
+		columns = (RecordColumns *) MemoryContextAllocZero(record->hctx,
+														   sizeof(RecordColumns));
+		record->columns = columns;
+	}
+
+	if (!columns->valid)
+	{
+		while (columns->columns)
+		{
+			column = columns->columns;
+			columns->columns = column->next;
+
+			release_memory(sizeof(RecordColumn) +
+						   columns->nrecords * sizeof(Datum) +
+						   (column->isnull ? columns->nrecords * sizeof(bool) : 0));
+			pfree(column->values);
+			if (column->isnull)
+				pfree(column->isnull);
+			pfree(column);
+		}
+
+		columns->nrecords = hash_get_num_entries(record->rhash);
+		columns->valid = true;
+	}
+
+	for (column = columns->columns; column; column = column->next)
+	{
+		if (column->attnum == attnum)
+		{
+			*values = column->values;
+			*isnull = column->isnull;
+			return columns->nrecords;
+		}
+	}
+
+	/* Unpack the attribute */
+	check_memory_limit(sizeof(RecordColumn) +
+					   columns->nrecords * (sizeof(Datum) + sizeof(bool)));
+
+	column = (RecordColumn *) MemoryContextAlloc(record->hctx,
+												 sizeof(RecordColumn));
+	column->attnum = attnum;
+	column->values = (Datum *)
+		MemoryContextAllocHuge(record->hctx,
+							   Max(columns->nrecords, 1) * sizeof(Datum));
+	column->isnull = (bool *)
+		MemoryContextAllocHuge(record->hctx,
+							   Max(columns->nrecords, 1) * sizeof(bool));
+
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+	{
+		column->values[i] = get_record_attr(item->tuple, record->tupdesc,
+											attnum, &column->isnull[i]);
+		hasnulls |= column->isnull[i];
+		i++;
+	}
+	Assert(i == columns->nrecords);
+
+	if (!hasnulls)
+	{
+		release_memory(columns->nrecords * sizeof(bool));
+		pfree(column->isnull);
+		column->isnull = NULL;
+	}
+
+	column->next = columns->columns;
+	columns->columns = column;
+
+	*values = column->values;
+	*isnull = column->isnull;
+	return columns->nrecords;
+}
+
+/*
+ * Remember the original version of a record, which is going to be changed for
+ * the first time within the actual state of the variable. If is_new is true
+ * the record has just been inserted, otherwise the entry holds the record
+ * before the change.
+ *
+ * Returns true if the original tuple was moved into the changes hash, so it
+ * must not be released by the caller.
+ */
+static bool
+save_record_change(Variable *variable, HashRecordEntry *item, bool is_new)
+{
+	VarState   *state = (VarState *) GetActualState(variable);
+	RecordVar  *record = &state->value.record;
+	HashRecordSearchKey k;
+	HashRecordEntry *change;
+	bool		found;
+
+	if (state->changes == NULL)
+		return false;
+
+	/* Reuse the hash of the entry */
+	k.key = item->key;
+	k.kind = record->key_kind;
+	k.cmp_proc = &record->cmp_proc;
+
+	change = (HashRecordEntry *) hash_search(state->changes, &k,
+											 HASH_ENTER, &found);
+	/* The original version is already saved */
+	if (found)
+		return false;
+
+	PERF_COUNT(records_saved, 1);
+
+	if (is_new)
+	{
+		Form_pg_attribute attr = GetTupleDescAttr(record->tupdesc, 0);
+
+		/*
+		 * There was no such record before, keep a copy of the key to be able
+		 * to remove the record on rollback.
+		 */
+		if (!item->key.is_null)
+			change->key.value = datumCopy(item->key.value, attr->attbyval,
+										  attr->attlen);
+		change->tuple = (Datum) 0;
+		return false;
+	}
+
+	change->tuple = item->tuple;
+	return true;
+}
+
+/*
+ * Release memory of an entry of changes hash.
+ */
+static void
+free_record_change(RecordVar *record, HashRecordEntry *change)
+{
+	if (change->tuple != (Datum) 0)
+		record_free_tuple(record, change->tuple);
+	else if (!change->key.is_null &&
+			 !GetTupleDescAttr(record->tupdesc, 0)->attbyval)
+		pfree(DatumGetPointer(change->key.value));
+}
+
+/*
+ * Insert a new record. New record key should be unique in the variable.
+ */
+void
+insert_record(Variable *variable, HeapTupleHeader tupleHeader)
+{
+	Datum		tuple;
+	Datum		value;
+	bool		isnull;
+	RecordVar  *record;
+	HashRecordSearchKey k;
+	HashRecordEntry *item;
+	bool		found;
+	MemoryContext oldcxt;
+
+	Assert(variable->typid == RECORDOID);
+
+	record = &(GetActualValue(variable).record);
+
+	oldcxt = MemoryContextSwitchTo(record->hctx);
+
+	tuple = copy_record_tuple(record, tupleHeader);
+
+	/* Inserting a new record */
+	value = get_record_key(tuple, record->tupdesc, &isnull);
+	/* First, check if there is a record with same key */
+	init_record_key(record, value, isnull, &k);
+
+	item = (HashRecordEntry *) hash_search(record->rhash, &k,
+										   HASH_ENTER, &found);
+	if (found)
+	{
+		record_free_tuple(record, tuple);
+		MemoryContextSwitchTo(oldcxt);
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("there is a record in the variable \"%s\" with same "
+						"key", GetName(variable))));
+	}
+	/* Second, insert a new record */
+	item->tuple = tuple;
+	record_indexes_add(record, item);
+	save_record_change(variable, item, true);
+	PERF_COUNT(record_inserts, 1);
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * Insert a record. New record key should be unique in the variable.
+ */
+bool
+update_record(Variable *variable, HeapTupleHeader tupleHeader)
+{
+	Datum		tuple;
+	Datum		value;
+	bool		isnull;
+	RecordVar  *record;
+	HashRecordSearchKey k;
+	HashRecordEntry *item;
+	bool		found;
+	Datum		old_tuple;
+	bool		saved;
+	MemoryContext oldcxt;
+
+	Assert(variable->typid == RECORDOID);
+
+	record = &(GetActualValue(variable).record);
+
+	oldcxt = MemoryContextSwitchTo(record->hctx);
+
+	tuple = copy_record_tuple(record, tupleHeader);
+
+	/* Update a record */
+	value = get_record_key(tuple, record->tupdesc, &isnull);
+	init_record_key(record, value, isnull, &k);
+
+	item = (HashRecordEntry *) hash_search(record->rhash, &k,
+										   HASH_FIND, &found);
+	if (!found)
+	{
+		record_free_tuple(record, tuple);
 		MemoryContextSwitchTo(oldcxt);
 		return false;
 	}
 
-	/* Release old tuple */
-	pfree(DatumGetPointer(item->tuple));
+	old_tuple = item->tuple;
+	saved = save_record_change(variable, item, false);
+	record_hash_indexes_remove(record, item);
+	/* The key of the entry should point to the new tuple */
+	item->key.value = value;
 	item->tuple = tuple;
+	record_indexes_add(record, item);
+	/* Release old tuple */
+	if (!saved)
+		record_free_tuple(record, old_tuple);
+	PERF_COUNT(record_updates, 1);
 
 	MemoryContextSwitchTo(oldcxt);
 	return true;
 }
 
+/*
+ * Insert a record or replace the record with the same key. The records hash is
+ * probed only once. Returns true if the record was inserted.
+ */
+bool
+upsert_record(Variable *variable, HeapTupleHeader tupleHeader)
+{
+	Datum		tuple;
+	Datum		value;
+	bool		isnull;
+	RecordVar  *record;
+	HashRecordSearchKey k;
+	HashRecordEntry *item;
+	bool		found;
+	Datum		old_tuple;
+	bool		saved;
+	MemoryContext oldcxt;
+
+	Assert(variable->typid == RECORDOID);
+
+	record = &(GetActualValue(variable).record);
+
+	oldcxt = MemoryContextSwitchTo(record->hctx);
+
+	/*
+	 * Copy the tuple before the hash is probed, so that an error of copying
+	 * doesn't leave an entry without a tuple.
+	 */
+	tuple = copy_record_tuple(record, tupleHeader);
+
+	value = get_record_key(tuple, record->tupdesc, &isnull);
+	init_record_key(record, value, isnull, &k);
+
+	item = (HashRecordEntry *) hash_search(record->rhash, &k,
+										   HASH_ENTER, &found);
+	if (!found)
+	{
+		item->tuple = tuple;
+		record_indexes_add(record, item);
+		save_record_change(variable, item, true);
+		PERF_COUNT(record_inserts, 1);
+
+		MemoryContextSwitchTo(oldcxt);
+		return true;
+	}
+
+	old_tuple = item->tuple;
+	saved = save_record_change(variable, item, false);
+	record_hash_indexes_remove(record, item);
+	/* The key of the entry should point to the new tuple */
+	item->key.value = value;
+	item->tuple = tuple;
+	record_indexes_add(record, item);
+
+	/*
+	 * Release old tuple. Its piece of the arena is reused by the next tuple of
+	 * the same size.
+	 */
+	if (!saved)
+		record_free_tuple(record, old_tuple);
+	PERF_COUNT(record_updates, 1);
+
+	MemoryContextSwitchTo(oldcxt);
+	return false;
+}
+
 bool
 delete_record(Variable *variable, Datum value, bool is_null)
 {
-	HashRecordKey k;
+	HashRecordSearchKey k;
 	HashRecordEntry *item;
 	bool		found;
 	RecordVar  *record;
@@ -521,57 +1952,442 @@ delete_record(Variable *variable, Datum value, bool is_null)
 	record = &(GetActualValue(variable).record);
 
 	/* Delete a record */
-	k.value = value;
-	k.is_null = is_null;
-	k.hash_proc = &record->hash_proc;
-	k.cmp_proc = &record->cmp_proc;
+	init_record_key(record, value, is_null, &k);
 
 	item = (HashRecordEntry *) hash_search(record->rhash, &k,
 										   HASH_REMOVE, &found);
 	if (found)
-		pfree(DatumGetPointer(item->tuple));
+		record_indexes_remove(record, item);
+	if (found && !save_record_change(variable, item, false))
+		record_free_tuple(record, item->tuple);
+	if (found)
+		PERF_COUNT(record_deletes, 1);
 
 	return found;
 }
 
 /*
- * Copy record using src_tuple.
+ * Rebuild the records hash and the memory context of the variable to hold
+ * nrows records without growing. Existing records are copied.
  */
 void
-insert_record_copy(RecordVar *dest_record, Datum src_tuple, Variable *variable)
+reserve_record(Variable *variable, long nrows)
 {
-	Datum		tuple;
+	VarState   *state = (VarState *) GetActualState(variable);
+	RecordVar  *record = &state->value.record;
+	RecordVar	old_record = *record;
+	HTAB	   *changes = state->changes;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+	RecordHashIndex *hindex;
+	MemoryContext oldcxt;
+
+	nrows = Max(nrows, hash_get_num_entries(old_record.rhash));
+	PERF_COUNT(rehashes, 1);
+
+	/* The actual state gets its own records, init_record() mustn't undo */
+	state->changes = NULL;
+	init_record(record, old_record.tupdesc, variable, nrows);
+
+	oldcxt = MemoryContextSwitchTo(record->hctx);
+
+	hash_seq_init(&rstat, old_record.rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+	{
+		HashRecordSearchKey k;
+		HashRecordEntry *new_item;
+		Datum		tuple;
+		bool		found;
+
+		tuple = copy_record_tuple(record,
+								  (HeapTupleHeader) DatumGetPointer(item->tuple));
+
+		/* The key points into the new tuple, its hash is the same */
+		k.key.value = get_record_key(tuple, record->tupdesc, &k.key.is_null);
+		k.key.hash = item->key.hash;
+		k.kind = record->key_kind;
+		k.cmp_proc = &record->cmp_proc;
+
+		new_item = (HashRecordEntry *) hash_search(record->rhash, &k,
+												   HASH_ENTER, &found);
+		Assert(!found);
+		new_item->tuple = tuple;
+	}
+
+	MemoryContextSwitchTo(oldcxt);
+
+	if (old_record.index)
+		create_record_index(record);
+	for (hindex = old_record.hash_indexes; hindex; hindex = hindex->next)
+		create_record_hash_index(record, hindex->attnum);
+
+	/* Give the shared records back to the previous state or release them */
+	if (changes)
+		rollback_record_changes(&old_record, changes);
+	else
+		MemoryContextDelete(old_record.hctx);
+}
+
+/*
+ * Remove all records of the variable, keeping its structure and indexes. If
+ * the records are shared with the previous state of the variable, they are
+ * given back to it without copying, so a savepoint costs nothing.
+ */
+void
+truncate_record(Variable *variable)
+{
+	VarState   *state = (VarState *) GetActualState(variable);
+	RecordVar  *record = &state->value.record;
+	RecordVar	old_record = *record;
+	bool		shared = state->changes != NULL;
+	RecordHashIndex *hindex;
+
+	if (old_record.rhash == NULL)
+		return;
+
+	/* Shared records are given back by init_record() */
+	init_record(record, old_record.tupdesc, variable, 0);
+
+	if (old_record.index)
+		create_record_index(record);
+	for (hindex = old_record.hash_indexes; hindex; hindex = hindex->next)
+		create_record_hash_index(record, hindex->attnum);
+
+	if (!shared)
+		MemoryContextDelete(old_record.hctx);
+}
+
+/*
+ * Write the structure, records and indexes of the record variable into the
+ * dump, see dump_package(). Records are written as their stored tuple images.
+ */
+void
+dump_record(RecordVar *record, StringInfo buf)
+{
+	TupleDesc	tupdesc = record->tupdesc;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+	RecordHashIndex *hindex;
+	int			nhash_indexes = 0;
+	int			i;
+
+	pq_sendint32(buf, tupdesc->natts);
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = GetTupleDescAttr(tupdesc, i);
+
+		pq_sendint32(buf, attr->atttypid);
+		pq_sendint32(buf, attr->atttypmod);
+		dump_name(buf, NameStr(attr->attname));
+	}
+
+	pq_sendint64(buf, hash_get_num_entries(record->rhash));
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+	{
+		HeapTupleHeader tuple = (HeapTupleHeader) DatumGetPointer(item->tuple);
+		uint32		len = HeapTupleHeaderGetDatumLength(tuple);
+
+		pq_sendint32(buf, len);
+		pq_sendbytes(buf, (char *) tuple, len);
+	}
+
+	pq_sendbyte(buf, record->index != NULL);
+	for (hindex = record->hash_indexes; hindex; hindex = hindex->next)
+		nhash_indexes++;
+	pq_sendint32(buf, nhash_indexes);
+	for (hindex = record->hash_indexes; hindex; hindex = hindex->next)
+		pq_sendint32(buf, hindex->attnum);
+}
+
+/*
+ * Insert the tuple image of the dumped record into the records hash. Its
+ * attributes aren't checked, the image is stored as is.
+ */
+static void
+load_record_tuple(RecordVar *record, const char *image, uint32 len)
+{
+	HeapTupleHeader tuple;
 	Datum		value;
 	bool		isnull;
-	HashRecordKey k;
+	HashRecordSearchKey k;
 	HashRecordEntry *item;
 	bool		found;
-	MemoryContext oldcxt;
 
-	oldcxt = MemoryContextSwitchTo(dest_record->hctx);
+	check_memory_limit(len);
 
-	/* Inserting a new record into dest_record */
-	tuple = copy_record_tuple(dest_record,
-							  (HeapTupleHeader) DatumGetPointer(src_tuple));
-	value = get_record_key(tuple, dest_record->tupdesc, &isnull);
+	tuple = (HeapTupleHeader) record_alloc_tuple(record, len);
+	memcpy((char *) tuple, image, len);
+	HeapTupleHeaderSetTypeId(tuple, record->tupdesc->tdtypeid);
+	HeapTupleHeaderSetTypMod(tuple, record->tupdesc->tdtypmod);
 
-	k.value = value;
-	k.is_null = isnull;
-	k.hash_proc = &dest_record->hash_proc;
-	k.cmp_proc = &dest_record->cmp_proc;
+	value = get_record_key(PointerGetDatum(tuple), record->tupdesc, &isnull);
+	init_record_key(record, value, isnull, &k);
 
-	item = (HashRecordEntry *) hash_search(dest_record->rhash, &k,
+	item = (HashRecordEntry *) hash_search(record->rhash, &k,
 										   HASH_ENTER, &found);
 	if (found)
 	{
-		pfree(DatumGetPointer(tuple));
-		MemoryContextSwitchTo(oldcxt);
+		record_free_tuple(record, PointerGetDatum(tuple));
 		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("there is a record in the variable \"%s\" with same "
-						"key", GetName(variable))));
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid dump of package"),
+				 errdetail("There are records with same key.")));
 	}
-	item->tuple = tuple;
+	item->tuple = PointerGetDatum(tuple);
+}
 
-	MemoryContextSwitchTo(oldcxt);
+/*
+ * Read the record variable from the dump. If build is false, the dump is only
+ * checked, otherwise records and indexes of the variable are built without
+ * the checks of the records made by pgv_insert().
+ */
+void
+load_record(Variable *variable, StringInfo buf, bool build)
+{
+	RecordVar  *record = build ? &(GetActualValue(variable).record) : NULL;
+	TupleDesc	tupdesc;
+	int			natts;
+	int64		nrecords;
+	int64		i;
+	int			nhash_indexes;
+	bool		has_index;
+
+	natts = pq_getmsgint(buf, 4);
+	if (natts <= 0 || natts > MaxTupleAttributeNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid dump of package"),
+				 errdetail("Invalid number of attributes %d.", natts)));
+
+#if PG_VERSION_NUM >= 120000
+	tupdesc = CreateTemplateTupleDesc(natts);
+#else
+	tupdesc = CreateTemplateTupleDesc(natts, false);
+#endif
+	for (i = 0; i < natts; i++)
+	{
+		Oid			typid = pq_getmsgint(buf, 4);
+		int32		typmod = pq_getmsgint(buf, 4);
+		char		attname[NAMEDATALEN];
+
+		load_name(buf, attname);
+		if (!SearchSysCacheExists1(TYPEOID, ObjectIdGetDatum(typid)))
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid dump of package"),
+					 errdetail("Type %u does not exist.", typid)));
+		TupleDescInitEntry(tupdesc, (AttrNumber) (i + 1), attname, typid,
+						   typmod, 0);
+	}
+
+	nrecords = pq_getmsgint64(buf);
+	if (nrecords < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid dump of package"),
+				 errdetail("Invalid number of records.")));
+
+	if (build)
+	{
+		init_record(record, tupdesc, variable, (long) nrecords);
+		variable->is_deleted = false;
+	}
+
+	for (i = 0; i < nrecords; i++)
+	{
+		uint32		len = pq_getmsgint(buf, 4);
+		const char *image = pq_getmsgbytes(buf, len);
+		HeapTupleHeaderData header;
+
+		/* The image may be unaligned */
+		if (len >= SizeofHeapTupleHeader)
+			memcpy(&header, image, SizeofHeapTupleHeader);
+		if (len < SizeofHeapTupleHeader ||
+			HeapTupleHeaderGetDatumLength(&header) != len ||
+			header.t_hoff < SizeofHeapTupleHeader || header.t_hoff > len ||
+			HeapTupleHeaderGetNatts(&header) > natts ||
+			HeapTupleHeaderHasExternal(&header))
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid dump of package"),
+					 errdetail("Invalid record image.")));
+
+		if (build)
+			load_record_tuple(record, image, len);
+	}
+
+	has_index = pq_getmsgbyte(buf) != 0;
+	if (has_index && build)
+		create_record_index(record);
+
+	nhash_indexes = pq_getmsgint(buf, 4);
+	for (i = 0; i < nhash_indexes; i++)
+	{
+		int			attnum = pq_getmsgint(buf, 4);
+
+		if (attnum <= 0 || attnum >= natts)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid dump of package"),
+					 errdetail("Invalid attribute number %d of index.",
+							   attnum)));
+		if (build)
+			create_record_hash_index(record, attnum);
+	}
+
+	FreeTupleDesc(tupdesc);
+}
+
+/*
+ * Create a hash to store original versions of records changed within a new
+ * state of the transactional variable.
+ */
+HTAB *
+make_record_changes(Variable *variable)
+{
+	HASHCTL		ctl;
+	char		hash_name[BUFSIZ];
+
+	snprintf(hash_name, BUFSIZ, "Changes hash for variable \"%s\"",
+			 GetName(variable));
+
+	ctl.keysize = sizeof(HashRecordKey);
+	ctl.entrysize = sizeof(HashRecordEntry);
+	ctl.hcxt = variable->package->hctxTransact;
+	ctl.hash = record_hash;
+	ctl.match = record_match;
+
+	return hash_create(hash_name, NUMVARIABLES, &ctl,
+					   HASH_ELEM | HASH_CONTEXT |
+					   HASH_FUNCTION | HASH_COMPARE);
+}
+
+/*
+ * Undo changes of records: restore original versions of changed records and
+ * remove inserted ones. The changes hash is destroyed.
+ */
+void
+rollback_record_changes(RecordVar *record, HTAB *changes)
+{
+	HASH_SEQ_STATUS hstat;
+	HashRecordEntry *change;
+
+	hash_seq_init(&hstat, changes);
+	while ((change = (HashRecordEntry *) hash_seq_search(&hstat)) != NULL)
+	{
+		HashRecordSearchKey k;
+		HashRecordEntry *item;
+		bool		found;
+
+		k.key = change->key;
+		k.kind = record->key_kind;
+		k.cmp_proc = &record->cmp_proc;
+
+		if (change->tuple == (Datum) 0)
+		{
+			/* The record didn't exist before */
+			item = (HashRecordEntry *) hash_search(record->rhash, &k,
+												   HASH_REMOVE, &found);
+			if (found)
+			{
+				record_indexes_remove(record, item);
+				record_free_tuple(record, item->tuple);
+			}
+			free_record_change(record, change);
+		}
+		else
+		{
+			Datum		old_tuple;
+
+			item = (HashRecordEntry *) hash_search(record->rhash, &k,
+												   HASH_ENTER, &found);
+			old_tuple = (Datum) 0;
+			if (found)
+			{
+				old_tuple = item->tuple;
+				record_hash_indexes_remove(record, item);
+			}
+			item->key = k.key;
+			item->tuple = change->tuple;
+			record_indexes_add(record, item);
+			if (found)
+				record_free_tuple(record, old_tuple);
+		}
+	}
+
+	hash_destroy(changes);
+}
+
+/*
+ * Forget original versions of changed records. The changes hash is destroyed.
+ */
+void
+discard_record_changes(RecordVar *record, HTAB *changes)
+{
+	HASH_SEQ_STATUS hstat;
+	HashRecordEntry *change;
+
+	hash_seq_init(&hstat, changes);
+	while ((change = (HashRecordEntry *) hash_seq_search(&hstat)) != NULL)
+		free_record_change(record, change);
+
+	hash_destroy(changes);
+}
+
+/*
+ * Merge changes of records with changes made earlier. For the records, which
+ * were changed in both, the earlier original versions win. The smaller hash
+ * is merged into the larger one, which is returned, the other one is
+ * destroyed.
+ */
+HTAB *
+merge_record_changes(RecordVar *record, HTAB *changes, HTAB *prev_changes)
+{
+	HASH_SEQ_STATUS hstat;
+	HashRecordEntry *change;
+	HTAB	   *from,
+			   *to;
+	bool		from_earlier;
+
+	if (hash_get_num_entries(changes) <= hash_get_num_entries(prev_changes))
+	{
+		from = changes;
+		to = prev_changes;
+		from_earlier = false;
+	}
+	else
+	{
+		from = prev_changes;
+		to = changes;
+		from_earlier = true;
+	}
+
+	hash_seq_init(&hstat, from);
+	while ((change = (HashRecordEntry *) hash_seq_search(&hstat)) != NULL)
+	{
+		HashRecordSearchKey k;
+		HashRecordEntry *item;
+		bool		found;
+
+		k.key = change->key;
+		k.kind = record->key_kind;
+		k.cmp_proc = &record->cmp_proc;
+
+		item = (HashRecordEntry *) hash_search(to, &k, HASH_ENTER, &found);
+		if (found && !from_earlier)
+			free_record_change(record, change);
+		else
+		{
+			/* The earlier original version replaces the later one */
+			if (found)
+				free_record_change(record, item);
+			item->key = k.key;
+			item->tuple = change->tuple;
+		}
+	}
+
+	hash_destroy(from);
+
+	return to;
 }
@@ -0,0 +1,600 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_variables_shared.c
+ *	  Record variables shared between backends
+ *
+ * A record variable can be published into shared memory to be read by all
+ * backends connected to the same database. Published records are kept in a
+ * dynamic shared memory area, the hash of shared variables is keyed by the
+ * database, package and variable names. Each publication makes a new version
+ * of the records, which is immutable, so readers don't lock records while
+ * they search them. Readers pin the version they search, it is freed when the
+ * last reference is gone.
+ *
+ * Shared variables require the library to be loaded via
+ * shared_preload_libraries.
+ *
+ * Copyright (c) 2015-2022, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#if PG_VERSION_NUM >= 110000
+#include "lib/dshash.h"
+#endif
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/typcache.h"
+
+#include "pg_variables.h"
+
+#if PG_VERSION_NUM >= 110000
+
+#define PGV_SHARED_NAME		"pg_variables"
+
+/* Control structure of shared variables in the main shared memory segment */
+typedef struct SharedControl
+{
+	LWLock	   *lock;			/* protects creation of the area */
+	int			tranche_id;		/* tranche of the area and the hash locks */
+	bool		initialized;	/* the area and the hash are created */
+	dsa_handle	area_handle;
+	dshash_table_handle hash_handle;
+	pg_atomic_uint64 last_version;
+} SharedControl;
+
+typedef struct SharedVariableKey
+{
+	Oid			dbid;
+	char		package[NAMEDATALEN];
+	char		name[NAMEDATALEN];
+} SharedVariableKey;
+
+typedef struct SharedVariableEntry
+{
+	SharedVariableKey key;
+	dsa_pointer records;		/* the actual version of records */
+} SharedVariableEntry;
+
+/* Type of a record attribute */
+typedef struct SharedAttribute
+{
+	Oid			atttypid;
+	int32		atttypmod;
+} SharedAttribute;
+
+/*
+ * Version of records of the shared variable, allocated as a single chunk.
+ * Attributes are followed by heads of buckets and records, which are linked
+ * into chains of buckets. Records and buckets are referenced by offsets from
+ * the beginning of the chunk since the area is mapped to different addresses
+ * in backends.
+ */
+typedef struct SharedRecords
+{
+	pg_atomic_uint32 refcount;	/* the hash entry and readers pinning it */
+	uint64		version;		/* unique number of the version */
+	int			natts;
+	uint32		nbuckets;		/* a power of 2 */
+	int64		nrecords;
+	SharedAttribute attrs[FLEXIBLE_ARRAY_MEMBER];
+} SharedRecords;
+
+/* Header of a shared record, the tuple follows it */
+typedef struct SharedRecord
+{
+	Size		next;			/* offset of the next record of the bucket */
+	uint32		hash;			/* hash of the key */
+} SharedRecord;
+
+#define SharedRecordsBuckets(records) \
+	((Size *) ((char *) (records) + \
+			   MAXALIGN(offsetof(SharedRecords, attrs) + \
+						(records)->natts * sizeof(SharedAttribute))))
+
+#define SharedRecordTuple(rec) \
+	((HeapTupleHeader) ((char *) (rec) + MAXALIGN(sizeof(SharedRecord))))
+
+/*
+ * Backend local descriptor of the shared variable, which is built once for
+ * each version of its records.
+ */
+typedef struct SharedVariableDesc
+{
+	SharedVariableKey key;
+	uint64		version;
+	/* Only the tuple descriptor and the key functions are used */
+	RecordVar	record;
+} SharedVariableDesc;
+
+static SharedControl *sharedControl = NULL;
+static dsa_area *sharedArea = NULL;
+static dshash_table *sharedHash = NULL;
+static HTAB *sharedDescs = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static void
+shared_shmem_request(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(SharedControl)));
+	RequestNamedLWLockTranche(PGV_SHARED_NAME, 1);
+}
+
+static void
+shared_shmem_startup(void)
+{
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	sharedControl = ShmemInitStruct(PGV_SHARED_NAME, sizeof(SharedControl),
+									&found);
+	if (!found)
+	{
+		sharedControl->lock = &(GetNamedLWLockTranche(PGV_SHARED_NAME))->lock;
+		sharedControl->tranche_id = LWLockNewTrancheId();
+		sharedControl->initialized = false;
+		pg_atomic_init_u64(&sharedControl->last_version, 0);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Install shared memory hooks if the library is being preloaded.
+ */
+void
+init_shared_variables(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = shared_shmem_request;
+#else
+	shared_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = shared_shmem_startup;
+}
+
+static void
+makeSharedHashParams(dshash_parameters *params)
+{
+	memset(params, 0, sizeof(dshash_parameters));
+	params->key_size = sizeof(SharedVariableKey);
+	params->entry_size = sizeof(SharedVariableEntry);
+	params->compare_function = dshash_memcmp;
+	params->hash_function = dshash_memhash;
+#if PG_VERSION_NUM >= 170000
+	params->copy_function = dshash_memcpy;
+#endif
+	params->tranche_id = sharedControl->tranche_id;
+}
+
+/*
+ * Attach to the area of shared variables, it is created by the first
+ * backend. Returns false if shared variables are not available and strict is
+ * false.
+ */
+static bool
+attachSharedVariables(bool strict)
+{
+	dshash_parameters params;
+	dsa_area   *area;
+	dshash_table *hash;
+	MemoryContext oldcxt;
+
+	if (sharedHash != NULL)
+		return true;
+
+	if (sharedControl == NULL)
+	{
+		if (!strict)
+			return false;
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("shared variables are not available"),
+				 errhint("Add pg_variables to \"shared_preload_libraries\".")));
+	}
+
+	makeSharedHashParams(&params);
+	LWLockRegisterTranche(sharedControl->tranche_id, PGV_SHARED_NAME);
+
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	LWLockAcquire(sharedControl->lock, LW_EXCLUSIVE);
+
+	if (!sharedControl->initialized)
+	{
+		area = dsa_create(sharedControl->tranche_id);
+		/* The area outlives backends */
+		dsa_pin(area);
+		hash = dshash_create(area, &params, NULL);
+
+		sharedControl->area_handle = dsa_get_handle(area);
+		sharedControl->hash_handle = dshash_get_hash_table_handle(hash);
+		sharedControl->initialized = true;
+	}
+	else
+	{
+		area = dsa_attach(sharedControl->area_handle);
+		hash = dshash_attach(area, &params, sharedControl->hash_handle, NULL);
+	}
+
+	LWLockRelease(sharedControl->lock);
+	MemoryContextSwitchTo(oldcxt);
+
+	/* Stay attached until the end of the session */
+	dsa_pin_mapping(area);
+	sharedArea = area;
+	sharedHash = hash;
+
+	return true;
+}
+
+static void
+makeSharedVariableKey(text *package_name, text *var_name,
+					  SharedVariableKey *key)
+{
+	/* Keys are compared as strings of bytes */
+	MemSet(key, 0, sizeof(SharedVariableKey));
+	key->dbid = MyDatabaseId;
+	getKeyFromName(package_name, key->package);
+	getKeyFromName(var_name, key->name);
+}
+
+/*
+ * Drop the reference to the version of records, the last one frees it.
+ */
+static void
+releaseSharedRecords(dsa_pointer dp)
+{
+	SharedRecords *records = (SharedRecords *) dsa_get_address(sharedArea, dp);
+
+	if (pg_atomic_sub_fetch_u32(&records->refcount, 1) == 0)
+		dsa_free(sharedArea, dp);
+}
+
+/*
+ * Copy records of the variable into a new version in the shared area.
+ */
+static dsa_pointer
+makeSharedRecords(RecordVar *record)
+{
+	TupleDesc	tupdesc = record->tupdesc;
+	int64		nrecords = hash_get_num_entries(record->rhash);
+	uint32		nbuckets = 1;
+	Size		size,
+				offset;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+	dsa_pointer dp;
+	SharedRecords *records;
+	Size	   *buckets;
+	int			i;
+
+	while (nbuckets < nrecords && nbuckets < ((uint32) 1 << 30))
+		nbuckets <<= 1;
+
+	/* Compute the size of the chunk */
+	offset = MAXALIGN(offsetof(SharedRecords, attrs) +
+					  tupdesc->natts * sizeof(SharedAttribute)) +
+		MAXALIGN(nbuckets * sizeof(Size));
+	size = offset;
+
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+		size += MAXALIGN(sizeof(SharedRecord)) +
+			MAXALIGN(HeapTupleHeaderGetDatumLength((HeapTupleHeader) DatumGetPointer(item->tuple)));
+
+	dp = dsa_allocate_extended(sharedArea, size, DSA_ALLOC_HUGE);
+	records = (SharedRecords *) dsa_get_address(sharedArea, dp);
+
+	/* The reference of the hash entry */
+	pg_atomic_init_u32(&records->refcount, 1);
+	records->version = pg_atomic_add_fetch_u64(&sharedControl->last_version, 1);
+	records->natts = tupdesc->natts;
+	records->nbuckets = nbuckets;
+	records->nrecords = nrecords;
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = GetTupleDescAttr(tupdesc, i);
+
+		records->attrs[i].atttypid = attr->atttypid;
+		records->attrs[i].atttypmod = attr->atttypmod;
+	}
+
+	buckets = SharedRecordsBuckets(records);
+	memset(buckets, 0, nbuckets * sizeof(Size));
+
+	/* Stored hashes of keys are the same for all backends */
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+	{
+		HeapTupleHeader tuple = (HeapTupleHeader) DatumGetPointer(item->tuple);
+		SharedRecord *rec = (SharedRecord *) ((char *) records + offset);
+		uint32		bucket = item->key.hash & (nbuckets - 1);
+
+		rec->hash = item->key.hash;
+		rec->next = buckets[bucket];
+		buckets[bucket] = offset;
+		memcpy(SharedRecordTuple(rec), tuple,
+			   HeapTupleHeaderGetDatumLength(tuple));
+
+		offset += MAXALIGN(sizeof(SharedRecord)) +
+			MAXALIGN(HeapTupleHeaderGetDatumLength(tuple));
+	}
+	Assert(offset == size);
+
+	return dp;
+}
+
+/*
+ * Publish records of the variable as the new version of the shared variable.
+ */
+void
+share_record(text *package_name, text *var_name, RecordVar *record)
+{
+	SharedVariableKey key;
+	SharedVariableEntry *entry;
+	dsa_pointer dp,
+				old_dp = InvalidDsaPointer;
+	bool		found;
+
+	makeSharedVariableKey(package_name, var_name, &key);
+	attachSharedVariables(true);
+
+	/* Readers keep using the previous version while the new one is made */
+	dp = makeSharedRecords(record);
+
+	entry = (SharedVariableEntry *) dshash_find_or_insert(sharedHash, &key,
+														  &found);
+	if (found)
+		old_dp = entry->records;
+	entry->records = dp;
+	dshash_release_lock(sharedHash, entry);
+
+	if (DsaPointerIsValid(old_dp))
+		releaseSharedRecords(old_dp);
+}
+
+/*
+ * Remove the shared variable. Returns false if there is no such a variable.
+ */
+bool
+unshare_record(text *package_name, text *var_name)
+{
+	SharedVariableKey key;
+	SharedVariableEntry *entry;
+	dsa_pointer dp;
+
+	makeSharedVariableKey(package_name, var_name, &key);
+	attachSharedVariables(true);
+
+	entry = (SharedVariableEntry *) dshash_find(sharedHash, &key, true);
+	if (entry == NULL)
+		return false;
+
+	dp = entry->records;
+	dshash_delete_entry(sharedHash, entry);
+	releaseSharedRecords(dp);
+
+	return true;
+}
+
+/*
+ * Get the local descriptor of the version of records.
+ */
+static SharedVariableDesc *
+getSharedVariableDesc(SharedVariableKey *key, SharedRecords *records)
+{
+	SharedVariableDesc *desc = NULL;
+	RecordVar	record;
+	bool		found;
+	MemoryContext oldcxt;
+	int			i;
+
+	if (sharedDescs == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(SharedVariableKey);
+		ctl.entrysize = sizeof(SharedVariableDesc);
+		sharedDescs = hash_create("Shared variables descriptors", NUMVARIABLES,
+								  &ctl, HASH_ELEM | HASH_BLOBS);
+	}
+	else
+		desc = (SharedVariableDesc *) hash_search(sharedDescs, key, HASH_FIND,
+												  NULL);
+
+	if (desc != NULL && desc->version == records->version)
+		return desc;
+
+	/* Build the descriptor of the new version before it is stored */
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+
+	MemSet(&record, 0, sizeof(RecordVar));
+#if PG_VERSION_NUM >= 120000
+	record.tupdesc = CreateTemplateTupleDesc(records->natts);
+#else
+	record.tupdesc = CreateTemplateTupleDesc(records->natts, false);
+#endif
+	for (i = 0; i < records->natts; i++)
+		TupleDescInitEntry(record.tupdesc, (AttrNumber) (i + 1), NULL,
+						   records->attrs[i].atttypid,
+						   records->attrs[i].atttypmod, 0);
+	record.tupdesc = BlessTupleDesc(record.tupdesc);
+	init_record_key_procs(&record, records->attrs[0].atttypid);
+
+	MemoryContextSwitchTo(oldcxt);
+
+	if (desc != NULL)
+		FreeTupleDesc(desc->record.tupdesc);
+	else
+		desc = (SharedVariableDesc *) hash_search(sharedDescs, key, HASH_ENTER,
+												  &found);
+	desc->version = records->version;
+	desc->record = record;
+
+	return desc;
+}
+
+/*
+ * Search the record of the shared variable by the key while the version of
+ * records is pinned.
+ */
+static Datum
+searchSharedRecord(SharedVariableKey *key, SharedRecords *records,
+				   Oid value_type, Datum value, bool is_null, bool *found)
+{
+	SharedVariableDesc *desc;
+	HashRecordSearchKey k;
+	Size		offset;
+
+	desc = getSharedVariableDesc(key, records);
+
+	if (!is_null && records->attrs[0].atttypid != value_type)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("requested value type differs from variable \"%s\" "
+						"key type", key->name)));
+
+	init_record_key(&desc->record, value, is_null, &k);
+
+	offset = SharedRecordsBuckets(records)[k.key.hash & (records->nbuckets - 1)];
+	while (offset != 0)
+	{
+		SharedRecord *rec = (SharedRecord *) ((char *) records + offset);
+
+		if (rec->hash == k.key.hash)
+		{
+			HeapTupleData tuple;
+			Datum		rec_value;
+			bool		rec_is_null;
+
+			tuple.t_len = HeapTupleHeaderGetDatumLength(SharedRecordTuple(rec));
+			tuple.t_data = SharedRecordTuple(rec);
+			rec_value = heap_getattr(&tuple, 1, desc->record.tupdesc,
+									 &rec_is_null);
+
+			if (match_record_key(&k, rec_value, rec_is_null))
+			{
+				HeapTupleHeader result;
+
+				/* The record type is identified by the local typmod */
+				result = (HeapTupleHeader) palloc(tuple.t_len);
+				memcpy(result, tuple.t_data, tuple.t_len);
+				HeapTupleHeaderSetTypeId(result, RECORDOID);
+				HeapTupleHeaderSetTypMod(result, desc->record.tupdesc->tdtypmod);
+
+				*found = true;
+				return PointerGetDatum(result);
+			}
+		}
+
+		offset = rec->next;
+	}
+
+	*found = false;
+	return (Datum) 0;
+}
+
+/*
+ * Search the record of the shared variable by the key. Returns false if
+ * there is no such a shared variable, *found tells if the record is found.
+ */
+bool
+select_shared_record(text *package_name, text *var_name, Oid value_type,
+					 Datum value, bool is_null, Datum *result, bool *found)
+{
+	SharedVariableKey key;
+	SharedVariableEntry *entry;
+	SharedRecords *records;
+	dsa_pointer dp;
+
+	if (!attachSharedVariables(false))
+		return false;
+
+	makeSharedVariableKey(package_name, var_name, &key);
+
+	entry = (SharedVariableEntry *) dshash_find(sharedHash, &key, false);
+	if (entry == NULL)
+		return false;
+
+	/* Pin the version to search it without locks */
+	dp = entry->records;
+	records = (SharedRecords *) dsa_get_address(sharedArea, dp);
+	pg_atomic_fetch_add_u32(&records->refcount, 1);
+	dshash_release_lock(sharedHash, entry);
+
+	PG_TRY();
+	{
+		*result = searchSharedRecord(&key, records, value_type, value,
+									 is_null, found);
+	}
+	PG_CATCH();
+	{
+		releaseSharedRecords(dp);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	releaseSharedRecords(dp);
+
+	return true;
+}
+
+#else							/* PG_VERSION_NUM < 110000 */
+
+void
+init_shared_variables(void)
+{
+}
+
+void
+share_record(text *package_name, text *var_name, RecordVar *record)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("shared variables are not supported by this PostgreSQL version")));
+}
+
+bool
+unshare_record(text *package_name, text *var_name)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("shared variables are not supported by this PostgreSQL version")));
+	return false;
+}
+
+bool
+select_shared_record(text *package_name, text *var_name, Oid value_type,
+					 Datum value, bool is_null, Datum *result, bool *found)
+{
+	return false;
+}
+
+#endif							/* PG_VERSION_NUM */
@@ -283,3 +283,353 @@ SELECT pgv_select('vars', 'r4');
 SELECT pgv_insert('vars', 'r5', foo) FROM foo; -- types: int, text
 SELECT pgv_insert('vars', 'r5', row(1, 'str1')); -- ok, UNKNOWNOID of 'str1' converts to TEXTOID
 SELECT pgv_select('vars', 'r5');
+
+-- Insert all records of an array
+SELECT pgv_insert_all('vars', 'r6', array_agg(foo)) FROM foo;
+SELECT pgv_insert_all('vars', 'r6', ARRAY[row(1, 'str1'), row(2, 'str2')]); -- ok, UNKNOWNOIDs convert to TEXTOID
+SELECT pgv_insert_all('vars', 'r6', ARRAY[row(3, 'str3'::text), row(1, 'str1'::text)]); -- fail
+SELECT * FROM pgv_select('vars', 'r6') AS (id int, t text) ORDER BY id;
+SELECT pgv_insert_all('vars', 'r6', ARRAY[1, 2]); -- fail
+SELECT pgv_insert_all('vars', 'r6', ARRAY[NULL::foo]); -- fail
+SELECT pgv_insert_all('vars', 'r7', '{}'::foo[]);
+SELECT pgv_exists('vars', 'r7');
+
+-- Reserve space for records
+SELECT pgv_reserve('vars', 'r6', 1000);
+SELECT * FROM pgv_select('vars', 'r6') AS (id int, t text) ORDER BY id;
+SELECT pgv_insert('vars', 'r6', row(4, 'str4'::text));
+SELECT pgv_select('vars', 'r6', 4);
+SELECT pgv_reserve('vars', 'r6', -1); -- fail
+SELECT pgv_reserve('vars', 'r7', 1000); -- fail
+
+-- Ordered index of records
+SELECT pgv_insert_all('vars', 'r8', ARRAY[row(5, 'str5'::text), row(3, 'str3'::text), row(NULL::int, 'strnull'::text), row(1, 'str1'::text)]);
+SELECT pgv_select_range('vars', 'r8', 2, 4); -- fail
+SELECT pgv_create_ordered_index('vars', 'r8');
+SELECT pgv_insert('vars', 'r8', row(4, 'str4'::text));
+SELECT pgv_insert('vars', 'r8', row(2, 'str2'::text));
+SELECT pgv_delete('vars', 'r8', 5);
+SELECT pgv_update('vars', 'r8', row(3, 'str33'::text));
+SELECT pgv_select('vars', 'r8');
+SELECT pgv_select_range('vars', 'r8', 2, 3);
+SELECT pgv_select_range('vars', 'r8', NULL::int, 2);
+SELECT pgv_select_range('vars', 'r8', 3, NULL::int);
+SELECT pgv_select_range('vars', 'r8', 3, 2);
+SELECT pgv_select_range('vars', 'r8', 'str'::text, NULL::text); -- fail
+SELECT pgv_reserve('vars', 'r8', 100);
+SELECT pgv_select('vars', 'r8');
+
+-- Hash indexes by other attributes
+SELECT pgv_insert_all('vars', 'r9', ARRAY[row(1, 'a'::text), row(2, 'b'::text), row(3, 'a'::text), row(4, NULL::text)]);
+SELECT pgv_select_by('vars', 'r9', 2, 'a'::text); -- fail
+SELECT pgv_create_index('vars', 'r9', 2);
+SELECT pgv_create_index('vars', 'r9', 3); -- fail
+SELECT * FROM pgv_select_by('vars', 'r9', 2, 'a'::text) AS (id int, t text) ORDER BY id;
+SELECT pgv_insert('vars', 'r9', row(5, 'b'::text));
+SELECT pgv_update('vars', 'r9', row(1, 'b'::text));
+SELECT pgv_delete('vars', 'r9', 2);
+SELECT * FROM pgv_select_by('vars', 'r9', 2, 'a'::text) AS (id int, t text) ORDER BY id;
+SELECT * FROM pgv_select_by('vars', 'r9', 2, 'b'::text) AS (id int, t text) ORDER BY id;
+SELECT * FROM pgv_select_by('vars', 'r9', 2, NULL::text) AS (id int, t text) ORDER BY id;
+SELECT * FROM pgv_select_by('vars', 'r9', 1, 3) AS (id int, t text);
+SELECT pgv_select_by('vars', 'r9', 2, 1); -- fail
+
+-- Keys with specialized hash and match routines
+SELECT pgv_insert_all('vars', 'r10', ARRAY[row(1::bigint, 'a'::text), row(5000000000::bigint, 'b'::text)]);
+SELECT pgv_select('vars', 'r10', 5000000000::bigint);
+SELECT pgv_insert_all('vars', 'r11', ARRAY[row('a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'::uuid, 1), row('b0eebc99-9c0b-4ef8-bb6d-6bb9bd380a12'::uuid, 2)]);
+SELECT pgv_select('vars', 'r11', 'b0eebc99-9c0b-4ef8-bb6d-6bb9bd380a12'::uuid);
+SELECT pgv_delete('vars', 'r11', 'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'::uuid);
+SELECT pgv_select('vars', 'r11', 'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'::uuid);
+
+-- Search for records by an array of keys in FROM clause
+SELECT * FROM pgv_select('vars', 'r9', ARRAY[5, 2, 5, 1]) AS (id int, t text);
+
+-- Records in FROM clause are returned at once, in target list one by one
+SELECT * FROM pgv_select('vars', 'r8') AS (id int, t text);
+SELECT pgv_select('vars', 'r8') LIMIT 2;
+
+-- Variables resolved by calls with constant names become invalid on removal
+DO $$
+DECLARE
+	i int;
+BEGIN
+	FOR i IN 1..2 LOOP
+		PERFORM pgv_set('vars', 'handle', i);
+		RAISE NOTICE 'handle: %', pgv_get('vars', 'handle', NULL::int);
+		PERFORM pgv_remove('vars', 'handle');
+		RAISE NOTICE 'removed: %', pgv_get('vars', 'handle', NULL::int, false);
+	END LOOP;
+END$$;
+
+-- Modification of scalar variables in place
+SELECT pgv_incr('vars', 'counter', 1);
+SELECT pgv_incr('vars', 'counter', 41);
+SELECT pgv_incr('vars', 'counter', 1::bigint); -- fail
+SELECT pgv_incr('vars', 'num', 1.5);
+SELECT pgv_incr('vars', 'num', 12345678901234567890.5);
+SELECT pgv_incr('vars', 'num', -12345678901234567890);
+SELECT pgv_incr('vars', 'str', 'a'::text); -- fail
+SELECT pgv_set('vars', 'str', 'abcdef'::text);
+SELECT pgv_set('vars', 'str', 'abc'::text);
+SELECT pgv_get('vars', 'str', NULL::text);
+SELECT pgv_append('vars', 'str', 'xyz');
+SELECT pgv_append('vars', 'str', pgv_get('vars', 'str', NULL::text));
+SELECT pgv_get('vars', 'str', NULL::text);
+SELECT pgv_append('vars', 'str2', 'new');
+SELECT pgv_get('vars', 'str2', NULL::text);
+SELECT pgv_append('vars', 'counter', 'new'); -- fail
+
+-- Statistics of packages and limit of memory
+SELECT pgv_set('stats', 'int', 1);
+SELECT pgv_set('stats', 'trans', 2, true);
+SELECT pgv_insert('stats', 'r', row(1, 'a'::text));
+SELECT pgv_insert('stats', 'r', row(2, 'b'::text));
+SELECT variables, records, regular_memory > 0 AS regular,
+	transactional_memory > 0 AS transactional,
+	allocated_memory = regular_memory + transactional_memory AS total
+	FROM pgv_stats() WHERE package = 'stats';
+SET pg_variables.max_memory = '1MB';
+SELECT pgv_set('stats', 'big', repeat('x', 2000000)); -- fail
+SELECT pgv_insert('stats', 'r', row(3, repeat('x', 2000000))); -- fail
+SELECT records FROM pgv_stats() WHERE package = 'stats';
+SELECT count(pgv_set('stats', 'wide', repeat('y', 600000 + i))) FROM generate_series(1, 100) i;
+SELECT pgv_set('stats', 'big', repeat('x', 600000)); -- fail
+SELECT pgv_remove('stats', 'wide');
+RESET pg_variables.max_memory;
+SELECT pgv_insert('stats', 'r', row(3, repeat('x', 2000000)));
+SELECT records FROM pgv_stats() WHERE package = 'stats';
+SELECT pgv_remove('stats');
+
+-- Shared variables require the module to be preloaded
+SELECT pgv_insert('shared', 'r', row(1, 'a'::text));
+SELECT pgv_share('shared', 'r'); -- fail
+SELECT pgv_unshare('shared', 'r'); -- fail
+SELECT pgv_select('shared', 'unknown', 1); -- fail
+SELECT pgv_remove('shared');
+
+-- Dump and load of packages
+SELECT pgv_set('dump', 'int', 101);
+SELECT pgv_set('dump', 'str', 'text value'::text);
+SELECT pgv_set('dump', 'null', NULL::text);
+SELECT pgv_set('dump', 'trans', 1.5, true);
+SELECT pgv_insert('dump', 'r', row(1, 'a'::text));
+SELECT pgv_insert('dump', 'r', row(2, NULL::text));
+SELECT pgv_create_index('dump', 'r', 2);
+CREATE TEMP TABLE dumps AS SELECT pgv_dump('dump') AS d;
+SELECT pgv_load(d) FROM dumps; -- fail
+SELECT pgv_remove('dump');
+SELECT pgv_load(d) FROM dumps;
+SELECT pgv_get('dump', 'int', NULL::int), pgv_get('dump', 'str', NULL::text),
+	pgv_get('dump', 'null', NULL::text), pgv_get('dump', 'trans', NULL::numeric);
+SELECT * FROM pgv_select('dump', 'r') AS (id int, t text) ORDER BY id;
+SELECT * FROM pgv_select_by('dump', 'r', 2, 'a'::text) AS (id int, t text);
+SELECT * FROM pgv_list() WHERE package = 'dump' ORDER BY name;
+SELECT pgv_load('\x00'::bytea); -- fail
+SELECT pgv_remove('dump');
+DROP TABLE dumps;
+
+-- Scans of record attributes
+SELECT pgv_insert('cols', 'r', row(i, i * 10, 'v' || i, i * 0.5::float8)) FROM generate_series(1, 5) i;
+SELECT pgv_insert('cols', 'r', row(6, NULL::int, NULL::text, NULL::float8));
+SELECT v FROM pgv_select_column('cols', 'r', 2, NULL::int) AS v ORDER BY v;
+SELECT pgv_count('cols', 'r', 2), pgv_sum('cols', 'r', 2), pgv_sum('cols', 'r', 4);
+SELECT * FROM pgv_min_max('cols', 'r', 3, NULL::text);
+
+-- Changes of records are seen by further scans
+SELECT pgv_update('cols', 'r', row(1, 100, 'z'::text, 1.0::float8));
+SELECT pgv_delete('cols', 'r', 5);
+SELECT pgv_count('cols', 'r', 2), pgv_sum('cols', 'r', 2);
+SELECT * FROM pgv_min_max('cols', 'r', 3, NULL::text);
+SELECT * FROM pgv_min_max('cols', 'r', 4, NULL::float8);
+SELECT pgv_insert('cols', 't', row(i, i::bigint), true) FROM generate_series(1, 3) i;
+SELECT pgv_sum('cols', 't', 2);
+BEGIN;
+SELECT pgv_insert('cols', 't', row(4, 9223372036854775807), true);
+SELECT pgv_sum('cols', 't', 2);
+ROLLBACK;
+SELECT pgv_sum('cols', 't', 2);
+SELECT pgv_sum('cols', 'r', 3); -- fail
+SELECT * FROM pgv_select_column('cols', 'r', 2, NULL::text); -- fail
+SELECT pgv_count('cols', 'r', 5); -- fail
+SELECT pgv_count('cols', 'r', NULL); -- fail
+SELECT pgv_remove('cols');
+
+-- Counters of work done by the session
+SET pg_variables.track_perf_stats = on;
+SELECT pgv_reset_perf_stats();
+SELECT pgv_set('perf', 'i', 1);
+SELECT pgv_get('perf', 'i', NULL::int);
+SELECT pgv_insert('perf', 'r', row(1, 'a'::text));
+SELECT pgv_insert('perf', 'r', row(2, 'b'::text));
+SELECT pgv_update('perf', 'r', row(1, 'c'::text));
+SELECT pgv_delete('perf', 'r', 2);
+SELECT * FROM pgv_select('perf', 'r') AS (id int, t text);
+SELECT pgv_select('perf', 'r', 1);
+SET pg_variables.track_perf_stats = off;
+SELECT pgv_get('perf', 'i', NULL::int);
+SELECT * FROM pgv_perf_stats()
+	WHERE counter IN ('scalar_gets', 'scalar_sets', 'record_inserts',
+					  'record_updates', 'record_deletes', 'records_returned');
+SELECT pgv_reset_perf_stats();
+SELECT count(*) FROM pgv_perf_stats() WHERE value <> 0;
+SELECT * FROM pgv_hash_stats('perf', 'r');
+SELECT * FROM pgv_hash_stats('perf', 'i'); -- fail
+SELECT pgv_remove('perf');
+
+-- Functions which only read variables are parallel restricted
+SELECT p.oid::regprocedure AS function FROM pg_proc p
+	WHERE proname LIKE 'pgv\_%' AND proparallel = 'r'
+	ORDER BY p.oid::regprocedure::text COLLATE "C";
+
+-- Cursors over records
+SELECT pgv_insert('cur', 'r', row(i, 'v' || i)) FROM generate_series(1, 5) i;
+SELECT pgv_cursor_open('cur', 'r');
+SELECT * FROM pgv_cursor_fetch(1, 2) AS (id int, t text);
+SELECT pgv_delete('cur', 'r', 3);
+SELECT pgv_insert('cur', 'r', row(0, 'v0'::text));
+SELECT pgv_insert('cur', 'r', row(10, 'v10'::text));
+SELECT * FROM pgv_cursor_fetch(1, 2) AS (id int, t text);
+SELECT * FROM pgv_cursor_fetch(1, 10) AS (id int, t text);
+SELECT * FROM pgv_cursor_fetch(1, 10) AS (id int, t text);
+SELECT pgv_cursor_close(1);
+SELECT * FROM pgv_cursor_fetch(1, 1) AS (id int, t text); -- fail
+SELECT pgv_cursor_open('cur', 'r');
+SELECT pgv_remove('cur');
+SELECT * FROM pgv_cursor_fetch(2, 1) AS (id int, t text); -- fail
+SELECT pgv_cursor_close(2);
+
+-- Bulk delete and truncate
+SELECT pgv_insert('del', 'r', row(i, 'v' || i)) FROM generate_series(1, 5) i;
+SELECT pgv_create_ordered_index('del', 'r');
+SELECT pgv_create_index('del', 'r', 2);
+SELECT pgv_delete('del', 'r', ARRAY[1, 3, 7]);
+SELECT * FROM pgv_select('del', 'r') AS (id int, t text);
+SELECT pgv_delete('del', 'r', ARRAY[1.5]); -- fail
+SELECT pgv_delete('del', 'r', ARRAY[[2], [4]]); -- fail
+SELECT pgv_delete('del', 'r', NULL::int[]); -- fail
+SELECT pgv_truncate('del', 'r');
+SELECT count(*) FROM pgv_select('del', 'r') AS (id int, t text);
+SELECT pgv_insert('del', 'r', row(6, 'v6'::text));
+SELECT * FROM pgv_select_by('del', 'r', 2, 'v6'::text) AS (id int, t text);
+SELECT * FROM pgv_select_range('del', 'r', NULL::int, NULL::int) AS (id int, t text);
+SELECT pgv_insert('del', 't', row(i, 'v' || i), true) FROM generate_series(1, 3) i;
+BEGIN;
+SAVEPOINT sp;
+SELECT pgv_truncate('del', 't');
+SELECT count(*) FROM pgv_select('del', 't') AS (id int, t text);
+ROLLBACK TO sp;
+SELECT count(*) FROM pgv_select('del', 't') AS (id int, t text);
+SELECT pgv_delete('del', 't', ARRAY[1, 2]);
+SELECT count(*) FROM pgv_select('del', 't') AS (id int, t text);
+ROLLBACK;
+SELECT count(*) FROM pgv_select('del', 't') AS (id int, t text);
+SELECT pgv_insert('del', 'r', row(7, 'v7'::text));
+BEGIN;
+DECLARE r_cur CURSOR FOR SELECT pgv_select('del', 'r');
+FETCH 1 IN r_cur;
+SELECT pgv_truncate('del', 'r');
+FETCH 1 IN r_cur;
+COMMIT;
+SELECT count(*) FROM pgv_select('del', 'r') AS (id int, t text);
+SELECT pgv_remove('del');
+
+-- Upsert of records
+SELECT pgv_upsert('ups', 'r', row(1, 'a'::text));
+SELECT pgv_upsert('ups', 'r', row(1, 'b'::text));
+SELECT * FROM pgv_select('ups', 'r') AS (id int, t text);
+SELECT pgv_create_index('ups', 'r', 2);
+SELECT pgv_upsert_all('ups', 'r', ARRAY[row(1, 'c'::text), row(2, 'd'::text), row(3, 'e'::text)]);
+SELECT * FROM pgv_select('ups', 'r') AS (id int, t text) ORDER BY id;
+SELECT * FROM pgv_select_by('ups', 'r', 2, 'b'::text) AS (id int, t text);
+SELECT * FROM pgv_select_by('ups', 'r', 2, 'c'::text) AS (id int, t text);
+SELECT pgv_upsert('ups', 'r', row(1, 2)); -- fail
+SELECT pgv_upsert_all('ups', 'r', ARRAY[1, 2]); -- fail
+SELECT pgv_upsert('ups', 't', row(1, 'a'::text), true);
+BEGIN;
+SELECT pgv_upsert('ups', 't', row(1, 'b'::text), true);
+SELECT pgv_upsert('ups', 't', row(2, 'c'::text), true);
+ROLLBACK;
+SELECT * FROM pgv_select('ups', 't') AS (id int, t text);
+SELECT pgv_remove('ups');
+
+-- Compression of wide values
+SET pg_variables.compression_threshold = 1000;
+SELECT pgv_set('comp', 't', repeat('a', 10000));
+SELECT pg_column_size(pgv_get('comp', 't', NULL::text)) < 1000;
+SELECT pgv_get('comp', 't', NULL::text) = repeat('a', 10000);
+SELECT pgv_set('comp', 'j', jsonb_build_object('a', repeat('a', 10000)));
+SELECT pg_column_size(pgv_get('comp', 'j', NULL::jsonb)) < 1000, length(pgv_get('comp', 'j', NULL::jsonb)->>'a');
+SELECT pgv_insert('comp', 'r', row(repeat('k', 2000), repeat('b', 10000)));
+SELECT pg_column_size(k) > 2000, pg_column_size(t) < 1000, length(t) FROM pgv_select('comp', 'r') AS (k text, t text);
+SELECT length(t) FROM pgv_select('comp', 'r', repeat('k', 2000)) AS (k text, t text);
+SELECT pgv_set('comp', 'a', repeat('a', 600));
+SELECT pgv_append('comp', 'a', repeat('a', 300));
+SELECT pg_column_size(pgv_get('comp', 'a', NULL::text)) > 900;
+SELECT pgv_append('comp', 'a', repeat('a', 9100));
+SELECT pg_column_size(pgv_get('comp', 'a', NULL::text)) < 1000, pgv_get('comp', 'a', NULL::text) = repeat('a', 10000);
+RESET pg_variables.compression_threshold;
+SELECT pgv_set('comp', 't', repeat('a', 10000));
+SELECT pg_column_size(pgv_get('comp', 't', NULL::text)) > 10000;
+SELECT pgv_remove('comp');
+
+-- Spilling of packages
+SELECT pgv_set('spill', 'int', 101);
+SELECT pgv_insert('spill', 'r', row(i, 'v' || i)) FROM generate_series(1, 3) i;
+SELECT pgv_create_ordered_index('spill', 'r');
+SELECT pgv_set('spill_trans', 'int', 102, true);
+SET pg_variables.spill_memory = 1;
+SELECT package, regular_memory, variables, records FROM pgv_stats() WHERE package = 'spill';
+SELECT transactional_memory > 0 FROM pgv_stats() WHERE package = 'spill_trans';
+SELECT pgv_get('spill', 'int', NULL::int);
+SELECT * FROM pgv_select_range('spill', 'r', 2, NULL::int) AS (id int, t text);
+BEGIN;
+SELECT pgv_set('spill', 'int', 103);
+SELECT variables, regular_memory > 0 FROM pgv_stats() WHERE package = 'spill';
+ROLLBACK;
+SELECT pgv_get('spill', 'int', NULL::int);
+SELECT * FROM pgv_list() WHERE package = 'spill' ORDER BY name COLLATE "C";
+BEGIN;
+SELECT count(*) FROM pgv_list('spill');
+SELECT package, regular_memory, variables FROM pgv_stats('spill');
+COMMIT;
+RESET pg_variables.spill_memory;
+SELECT pgv_remove('spill');
+SELECT pgv_remove('spill_trans');
+
+-- Filters of pgv_list() and pgv_stats()
+SELECT pgv_set('filter_a', 'v1', 1);
+SELECT pgv_set('filter_a', 'v2', 2, true);
+SELECT pgv_set('filter_b', 'v', 3);
+SELECT pgv_insert('filterc', 'r', row(1, 'a'::text));
+SELECT * FROM pgv_list('filterc');
+SELECT * FROM pgv_list('filter%') ORDER BY package COLLATE "C", name COLLATE "C";
+SELECT * FROM pgv_list('%\_b');
+SELECT * FROM pgv_list('nofilter%');
+SELECT package, variables, records FROM pgv_stats('filterc');
+SELECT package, variables, records FROM pgv_stats('filter%') ORDER BY package COLLATE "C";
+SELECT package, variables, records FROM pgv_stats('filter\__') ORDER BY package COLLATE "C";
+SELECT * FROM pgv_stats('nofilter');
+SELECT * FROM pgv_list(NULL); -- fail
+SELECT pgv_remove('filter_a');
+SELECT pgv_remove('filter_b');
+SELECT pgv_remove('filterc');
+
+-- Planner estimates of pgv_select()
+CREATE FUNCTION explain_rows(query text) RETURNS SETOF text AS $$
+DECLARE
+	ln text;
+BEGIN
+	FOR ln IN EXECUTE 'EXPLAIN (COSTS ON) ' || query
+	LOOP
+		RETURN NEXT substring(ln FROM 'rows=\d+');
+	END LOOP;
+END;
+$$ LANGUAGE plpgsql;
+SELECT pgv_insert('est', 'r', row(i, 'v' || i)) FROM generate_series(1, 5) i;
+SELECT explain_rows('SELECT * FROM pgv_select(''est'', ''r'') AS (id int, t text)');
+SELECT explain_rows('SELECT * FROM pgv_select(''est'', ''r'', ARRAY[1, 2, 3]) AS (id int, t text)');
+SELECT explain_rows('SELECT * FROM pgv_select(''est'', ''r'', ARRAY[1, 2, 3, 4, 5, 6, 7, 8]) AS (id int, t text)');
+SELECT explain_rows('SELECT * FROM pgv_select(''est'', ''none'') AS (id int, t text)');
+SELECT pgv_remove('est');
+DROP FUNCTION explain_rows(text);
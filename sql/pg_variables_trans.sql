@@ -1191,3 +1191,174 @@ BEGIN;
 	ROLLBACK TO SAVEPOINT sp1;
 	FETCH 1 in r1_cur;
 ROLLBACK;
+
+--
+-- Records of a transactional variable within nested savepoints
+--
+SELECT pgv_free();
+SELECT pgv_insert('test', 'r', ROW (1::int, 'a'::text), true);
+SELECT pgv_insert('test', 'r', ROW (2::int, 'b'::text), true);
+BEGIN;
+SELECT pgv_update('test', 'r', ROW (1::int, 'a1'::text));
+SAVEPOINT sp1;
+SELECT pgv_delete('test', 'r', 2);
+SELECT pgv_insert('test', 'r', ROW (3::int, 'c'::text), true);
+SAVEPOINT sp2;
+SELECT pgv_update('test', 'r', ROW (1::int, 'a2'::text));
+SELECT pgv_insert('test', 'r', ROW (2::int, 'b2'::text), true);
+SELECT pgv_delete('test', 'r', 3);
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text) ORDER BY id;
+ROLLBACK TO sp2;
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text) ORDER BY id;
+SAVEPOINT sp3;
+SELECT pgv_update('test', 'r', ROW (3::int, 'c3'::text));
+RELEASE sp3;
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text) ORDER BY id;
+ROLLBACK TO sp1;
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text) ORDER BY id;
+SAVEPOINT sp4;
+SELECT pgv_delete('test', 'r', 1);
+RELEASE sp4;
+COMMIT;
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text) ORDER BY id;
+
+BEGIN;
+SELECT pgv_insert('test', 'r', ROW (4::int, 'd'::text), true);
+SAVEPOINT sp1;
+SELECT pgv_update('test', 'r', ROW (2::int, 'b1'::text));
+RELEASE sp1;
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text) ORDER BY id;
+ROLLBACK;
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text) ORDER BY id;
+SELECT pgv_free();
+
+SELECT pgv_insert('test', 'r', ROW (1::int, 'a'::text), true);
+BEGIN;
+SAVEPOINT sp1;
+SELECT pgv_insert('test', 'r', ROW (2::int, 'b'::text), true);
+SELECT pgv_reserve('test', 'r', 1000);
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text) ORDER BY id;
+ROLLBACK TO sp1;
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text) ORDER BY id;
+SELECT pgv_reserve('test', 'r', 1000);
+RELEASE sp1;
+COMMIT;
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text) ORDER BY id;
+SELECT pgv_free();
+
+SELECT pgv_insert_all('test', 'r', ARRAY[ROW (3::int, 'c'::text), ROW (1::int, 'a'::text)], true);
+SELECT pgv_create_ordered_index('test', 'r');
+BEGIN;
+SAVEPOINT sp1;
+SELECT pgv_insert('test', 'r', ROW (2::int, 'b'::text), true);
+SELECT pgv_delete('test', 'r', 3);
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text);
+ROLLBACK TO sp1;
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text);
+SELECT pgv_update('test', 'r', ROW (1::int, 'aa'::text));
+SELECT * FROM pgv_select_range('test', 'r', 1, 2) AS (id int, t text);
+COMMIT;
+SELECT * FROM pgv_select('test', 'r') AS (id int, t text);
+SELECT pgv_free();
+
+SELECT pgv_insert_all('test', 'r', ARRAY[ROW (1::int, 'a'::text), ROW (2::int, 'b'::text)], true);
+SELECT pgv_create_index('test', 'r', 2);
+BEGIN;
+SAVEPOINT sp1;
+SELECT pgv_update('test', 'r', ROW (1::int, 'b'::text));
+SELECT pgv_insert('test', 'r', ROW (3::int, 'a'::text), true);
+SELECT * FROM pgv_select_by('test', 'r', 2, 'a'::text) AS (id int, t text) ORDER BY id;
+SELECT * FROM pgv_select_by('test', 'r', 2, 'b'::text) AS (id int, t text) ORDER BY id;
+ROLLBACK TO sp1;
+SELECT * FROM pgv_select_by('test', 'r', 2, 'a'::text) AS (id int, t text) ORDER BY id;
+SELECT * FROM pgv_select_by('test', 'r', 2, 'b'::text) AS (id int, t text) ORDER BY id;
+COMMIT;
+SELECT pgv_free();
+
+-- Modification of transactional scalar variables
+BEGIN;
+SELECT pgv_incr('test', 'counter', 1, true);
+SAVEPOINT sp1;
+SELECT pgv_incr('test', 'counter', 10, true);
+SELECT pgv_append('test', 'str', 'a', true);
+ROLLBACK TO sp1;
+SELECT pgv_incr('test', 'counter', 100, true);
+SELECT pgv_get('test', 'str', NULL::text, false);
+COMMIT;
+SELECT pgv_get('test', 'counter', NULL::int);
+SELECT pgv_free();
+
+-- Rollback and release of packages with regular variables in savepoints,
+-- parent levels have no changes
+BEGIN;
+SAVEPOINT sp1;
+SELECT pgv_set('lazy1', 'regular', 1);
+ROLLBACK TO sp1;
+COMMIT;
+BEGIN;
+SELECT pgv_set('lazy1', 'trans', 2, true);
+COMMIT;
+SELECT * FROM pgv_list() ORDER BY package, name;
+BEGIN;
+SELECT pgv_remove('lazy1');
+ROLLBACK;
+SELECT * FROM pgv_list() ORDER BY package, name;
+SELECT pgv_get('lazy1', 'trans', NULL::int);
+BEGIN;
+SAVEPOINT sp1;
+SAVEPOINT sp2;
+SELECT pgv_set('lazy2', 'regular', 1);
+RELEASE sp2;
+ROLLBACK TO sp1;
+COMMIT;
+BEGIN;
+SELECT pgv_set('lazy2', 'trans', 2, true);
+COMMIT;
+BEGIN;
+SAVEPOINT sp1;
+SAVEPOINT sp2;
+SELECT pgv_remove('lazy2');
+RELEASE sp2;
+ROLLBACK TO sp1;
+COMMIT;
+SELECT * FROM pgv_list() ORDER BY package, name;
+BEGIN;
+SELECT pgv_remove('lazy2');
+ROLLBACK;
+SELECT pgv_get('lazy2', 'trans', NULL::int);
+SELECT pgv_free();
+
+-- Original versions of records are kept on release of a savepoint, when
+-- either of levels has more changes
+SELECT pgv_insert('mrg', 'r', row(i, 'a'::text), true) FROM generate_series(1, 4) i;
+BEGIN;
+SAVEPOINT sp_outer;
+SELECT pgv_update('mrg', 'r', row(1, 'b'::text));
+SELECT pgv_update('mrg', 'r', row(2, 'b'::text));
+SELECT pgv_update('mrg', 'r', row(3, 'b'::text));
+SELECT pgv_insert('mrg', 'r', row(5, 'b'::text), true);
+SAVEPOINT sp_inner;
+SELECT pgv_update('mrg', 'r', row(1, 'c'::text));
+SELECT pgv_delete('mrg', 'r', 2);
+RELEASE sp_inner;
+SELECT * FROM pgv_select('mrg', 'r') AS (id int, t text) ORDER BY id;
+ROLLBACK TO sp_outer;
+SELECT * FROM pgv_select('mrg', 'r') AS (id int, t text) ORDER BY id;
+COMMIT;
+SELECT * FROM pgv_select('mrg', 'r') AS (id int, t text) ORDER BY id;
+BEGIN;
+SAVEPOINT sp_outer;
+SELECT pgv_update('mrg', 'r', row(1, 'b'::text));
+SAVEPOINT sp_inner;
+SELECT pgv_update('mrg', 'r', row(1, 'c'::text));
+SELECT pgv_update('mrg', 'r', row(2, 'c'::text));
+SELECT pgv_update('mrg', 'r', row(3, 'c'::text));
+SELECT pgv_delete('mrg', 'r', 4);
+SELECT pgv_insert('mrg', 'r', row(5, 'c'::text), true);
+RELEASE sp_inner;
+SELECT * FROM pgv_select('mrg', 'r') AS (id int, t text) ORDER BY id;
+ROLLBACK TO sp_outer;
+SELECT * FROM pgv_select('mrg', 'r') AS (id int, t text) ORDER BY id;
+COMMIT;
+SELECT * FROM pgv_select('mrg', 'r') AS (id int, t text) ORDER BY id;
+SELECT pgv_free();
@@ -0,0 +1,95 @@
+# Tests of record variables shared between sessions, they require the module
+# to be preloaded.
+use strict;
+use warnings;
+
+use PostgreSQL::Test::Cluster;
+use PostgreSQL::Test::Utils;
+use Test::More;
+
+my $node = PostgreSQL::Test::Cluster->new('main');
+$node->init;
+$node->append_conf('postgresql.conf',
+	"shared_preload_libraries = 'pg_variables'");
+$node->start;
+
+$node->safe_psql('postgres', 'CREATE EXTENSION pg_variables');
+$node->safe_psql('postgres', 'CREATE DATABASE other');
+$node->safe_psql('other', 'CREATE EXTENSION pg_variables');
+
+my ($ret, $stdout, $stderr);
+
+# Publish records in one session, search them in another one
+$node->safe_psql(
+	'postgres', q{
+	SELECT pgv_insert('pack', 'r', row(i, 'v' || i)) FROM generate_series(1, 3) i;
+	SELECT pgv_share('pack', 'r');
+});
+
+is($node->safe_psql('postgres', q{SELECT pgv_select('pack', 'r', 2)}),
+	'(2,v2)', 'record of shared variable is found');
+is( $node->safe_psql(
+		'postgres', q{SELECT pgv_select('pack', 'r', 5) IS NULL}),
+	't',
+	'missing key of shared variable');
+
+# Variables are shared within the database only
+($ret, $stdout, $stderr) =
+  $node->psql('other', q{SELECT pgv_select('pack', 'r', 2)});
+isnt($ret, 0, 'shared variable is not visible in other database');
+like($stderr, qr/unrecognized package "pack"/, 'error in other database');
+
+# The local variable takes precedence over the shared one
+is( $node->safe_psql(
+		'postgres', q{
+	SELECT pgv_insert('pack', 'r', row(2, 'local'::text));
+	SELECT pgv_select('pack', 'r', 2);
+}), "\n(2,local)", 'local variable is searched first');
+
+# A session sees new versions of the shared variable, and the versions it
+# searched before are freed
+is( $node->safe_psql(
+		'postgres', q{
+	SELECT pgv_insert('pack', 'r', row(i, 'v' || i)) FROM generate_series(1, 3) i;
+	SELECT pgv_share('pack', 'r');
+	SELECT pgv_remove('pack');
+	SELECT pgv_select('pack', 'r', 1);
+	SELECT pgv_insert('pack', 'r', row(1, 'new'::text));
+	SELECT pgv_insert('pack', 'r', row(4, 'v4'::text));
+	SELECT pgv_share('pack', 'r');
+	SELECT pgv_remove('pack');
+	SELECT pgv_select('pack', 'r', 1);
+	SELECT pgv_select('pack', 'r', 2) IS NULL;
+	SELECT pgv_select('pack', 'r', 4);
+}), "\n\n\n\n\n(1,v1)\n\n\n\n\n(1,new)\nt\n(4,v4)",
+	'republished variable is searched');
+
+# Republish the variable many times, only the last version stays
+$node->safe_psql(
+	'postgres', q{
+	SELECT pgv_insert('pack', 'r', row(i, 'v' || i)) FROM generate_series(1, 100) i;
+	SELECT pgv_share('pack', 'r') FROM generate_series(1, 100);
+});
+is( $node->safe_psql(
+		'postgres', q{
+	SELECT count(pgv_select('pack', 'r', i)) FROM generate_series(1, 100) i;
+}), '100', 'all records of the last version are found');
+
+# Remove the shared variable
+$node->safe_psql('postgres', q{SELECT pgv_unshare('pack', 'r')});
+($ret, $stdout, $stderr) =
+  $node->psql('postgres', q{SELECT pgv_select('pack', 'r', 1)});
+isnt($ret, 0, 'removed shared variable is not found');
+like($stderr, qr/unrecognized package "pack"/, 'error after unshare');
+
+($ret, $stdout, $stderr) =
+  $node->psql('postgres', q{SELECT pgv_unshare('pack', 'r')});
+isnt($ret, 0, 'second unshare fails');
+like(
+	$stderr,
+	qr/unrecognized shared variable "r"/,
+	'error of second unshare');
+
+$node->stop;
+
+done_testing();